@@ -1,6 +1,7 @@
 #include "Application.h"
 #include "Control.h"
 #include "LuaUtil.h"
+#include "Trace.h"
 #include "cheats/Cheats.h"
 
 #include "gamecontrollerdb.h"
@@ -72,6 +73,13 @@ hc::Application::Application()
     , _audio(this)
     , _input(this)
     , _perf(this)
+    , _pacer(this)
+    , _rewind(this)
+    , _runAhead(this)
+    , _savestates(this)
+    , _stateMemory(this)
+    , _frameBudget(this)
+    , _metrics(this)
     , _control(this)
     , _memorySelector(this)
     , _devices(this)
@@ -79,7 +87,7 @@ hc::Application::Application()
     , _debugger(this, &_config, &_memorySelector)
 {}
 
-bool hc::Application::init(std::string const& title, int const width, int const height) {
+bool hc::Application::init(std::string const& title, int const width, int const height, bool const headless) {
     class Undo {
     public:
         ~Undo() {
@@ -106,21 +114,40 @@ bool hc::Application::init(std::string const& title, int const width, int const
     }
 
     Desktop::init(&_logger);
+    setCoreMutex(&_coreMutex);
     addView(&_logger, true, false);
 
+    _headless = headless;
+    _inFrame = false;
+    _window = nullptr;
+    _glContext = nullptr;
+    _audioDev = 0;
+
     {
         // Redirect SDL logs
         SDL_LogSetOutputFunction(sdlPrint, this);
         SDL_LogSetAllPriority(SDL_LOG_PRIORITY_VERBOSE);
 
-        // Setup SDL
-        if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
+        // Setup SDL, only the timer is needed in headless mode
+        if (SDL_Init(headless ? SDL_INIT_TIMER : SDL_INIT_EVERYTHING) != 0) {
             error(TAG "Error in SDL_Init: %s", SDL_GetError());
             return false;
         }
 
         undo.add([]() { SDL_Quit(); });
+    }
+
+    if (headless) {
+        // No audio device, the resampled audio is discarded after each frame
+        memset(&_audioSpec, 0, sizeof(_audioSpec));
 
+        _audioSpec.freq = 44100;
+        _audioSpec.format = AUDIO_F32SYS;
+        _audioSpec.channels = 2;
+        _audioSpec.samples = 1024;
+        _audioSpec.size = _audioSpec.samples * _audioSpec.channels * sizeof(float);
+    }
+    else {
         // Setup window
         SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
         SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
@@ -161,7 +188,7 @@ bool hc::Application::init(std::string const& title, int const width, int const
         memset(&want, 0, sizeof(want));
 
         want.freq = 44100;
-        want.format = AUDIO_S16SYS;
+        want.format = AUDIO_F32SYS;
         want.channels = 2;
         want.samples = 1024;
         want.callback = audioCallback;
@@ -180,15 +207,6 @@ bool hc::Application::init(std::string const& title, int const width, int const
 
         undo.add([this]() { SDL_CloseAudioDevice(_audioDev); });
 
-        if (!_fifo.init(_audioSpec.size * 2)) {
-            error(TAG "Error in audio FIFO init");
-            return false;
-        }
-
-        undo.add([this]() { _fifo.destroy(); });
-
-        SDL_PauseAudioDevice(_audioDev, 0);
-
         // Add controller mappings
         SDL_RWops* const ctrldb = SDL_RWFromMem(
             const_cast<void*>(static_cast<void const*>(gamecontrollerdb_txt)),
@@ -202,6 +220,19 @@ bool hc::Application::init(std::string const& title, int const width, int const
     }
 
     {
+        if (!_fifo.init(_audioSpec.size * 2)) {
+            error(TAG "Error in audio FIFO init");
+            return false;
+        }
+
+        undo.add([this]() { _fifo.destroy(); });
+
+        if (_audioDev != 0) {
+            SDL_PauseAudioDevice(_audioDev, 0);
+        }
+    }
+
+    if (!headless) {
         // Setup ImGui
         IMGUI_CHECKVERSION();
 
@@ -316,6 +347,13 @@ bool hc::Application::init(std::string const& title, int const width, int const
         addView(&_audio, true, false);
         addView(&_input, true, false);
         addView(&_perf, true, false);
+        addView(&_pacer, true, false);
+        addView(&_rewind, true, false);
+        addView(&_runAhead, true, false);
+        addView(&_savestates, true, false);
+        addView(&_stateMemory, true, false);
+        addView(&_frameBudget, true, false);
+        addView(&_metrics, true, false);
 
         addView(&_control, true, false);
         addView(&_memorySelector, true, false);
@@ -327,13 +365,20 @@ bool hc::Application::init(std::string const& title, int const width, int const
             return false;
         }
 
-        _video.init();
+        _video.init(headless, &_perf);
         _led.init();
-        _audio.init(_audioSpec.freq, &_fifo);
+        _audio.init(_audioSpec.freq, _audioSpec.samples, &_fifo, &_perf);
         _input.init(&frontend);
         _perf.init();
-
-        _control.init(&_fsm, &_logger);
+        _pacer.init(&_video);
+        _rewind.init(&_video, &_perf);
+        _runAhead.init(&_config, &_video, &_audio, &_perf);
+        _savestates.init(&_config, &_perf);
+        _stateMemory.init(&_memorySelector, &_perf);
+        _frameBudget.init();
+        _metrics.init(&_perf, &_audio, _L);
+
+        _control.init(this, &_fsm, &_logger, &_pacer);
         _memorySelector.init();
         _devices.init(&_video);
         _repl.init();
@@ -384,21 +429,28 @@ void hc::Application::destroy() {
     Desktop::onQuit();
     lua_close(_L);
 
-    ImGui_ImplOpenGL2_Shutdown();
-    ImGui_ImplSDL2_Shutdown();
-    ImGui::DestroyContext();
+    if (!_headless) {
+        ImGui_ImplOpenGL2_Shutdown();
+        ImGui_ImplSDL2_Shutdown();
+        ImGui::DestroyContext();
+
+        SDL_CloseAudioDevice(_audioDev);
+    }
 
-    SDL_CloseAudioDevice(_audioDev);
     _fifo.destroy();
 
-    SDL_GL_DeleteContext(_glContext);
-    SDL_DestroyWindow(_window);
+    if (!_headless) {
+        SDL_GL_DeleteContext(_glContext);
+        SDL_DestroyWindow(_window);
+    }
+
     SDL_Quit();
 }
 
 void hc::Application::run() {
-    bool done = false;
-    lrcpp::Frontend& frontend = lrcpp::Frontend::getInstance();
+    _done = false;
+    Trace::setThreadName("ui");
+    _emulationThread = std::thread(&Application::emulate, this);
 
     do {
         SDL_Event event;
@@ -408,29 +460,29 @@ void hc::Application::run() {
             _devices.process(&event);
 
             if (event.type == SDL_QUIT) {
-                done = _fsm.quit();
+                std::lock_guard<std::mutex> lock(_coreMutex);
+                _done = _fsm.quit();
             }
         }
 
-        if (_fsm.currentState() == LifeCycle::State::GameRunning) {
-            if (_runningTime.getTimeUs() >= _nextFrameTime) {
-                _nextFrameTime += _coreUsPerFrame;
-
-                _perf.start(&_runPerf);
-                frontend.run();
-                _perf.stop(&_runPerf);
+        _input.snapshot();
 
-                _audio.flush();
-                onFrame();
-            }
-        }
+        uint64_t const t0 = Perf::getTimeNs();
+        _video.present();
+        uint64_t const t1 = Perf::getTimeNs();
+        _frameBudget.add(FrameBudget::Phase::Upload, t1 - t0);
 
         ImGui_ImplOpenGL2_NewFrame();
         ImGui_ImplSDL2_NewFrame(_window);
         ImGui::NewFrame();
 
+        // Desktop::onDraw locks the core mutex only for the views that
+        // draw core state
+        uint64_t const t2 = Perf::getTimeNs();
         onDraw();
+        _frameBudget.add(FrameBudget::Phase::Draw, Perf::getTimeNs() - t2);
 
+        uint64_t const t3 = Perf::getTimeNs();
         ImGui::Render();
 
         glViewport(0, 0, (int)ImGui::GetIO().DisplaySize.x, (int)ImGui::GetIO().DisplaySize.y);
@@ -439,10 +491,250 @@ void hc::Application::run() {
 
         ImGui_ImplOpenGL2_RenderDrawData(ImGui::GetDrawData());
 
+        uint64_t const t4 = Perf::getTimeNs();
+        _frameBudget.add(FrameBudget::Phase::Render, t4 - t3);
+
         SDL_GL_SwapWindow(_window);
+        _frameBudget.add(FrameBudget::Phase::Swap, Perf::getTimeNs() - t4);
         SDL_Delay(1);
     }
-    while (!done);
+    while (!_done);
+
+    _emulationThread.join();
+}
+
+int hc::Application::runHeadless(
+    char const* const corePath,
+    char const* const contentPath,
+    char const* const scriptPath,
+    int const argc,
+    char const* const* const argv) {
+
+    // There's no emulation thread, frames are run by the script
+    if (!startHeadless(corePath, contentPath)) {
+        return EXIT_FAILURE;
+    }
+
+    static auto const main = [](lua_State* const L) -> int {
+        char const* const path = luaL_checkstring(L, 1);
+
+        if (luaL_loadfilex(L, path, "t") != LUA_OK) {
+            return lua_error(L);
+        }
+
+        // Call the script with the remaining arguments
+        lua_replace(L, 1);
+        lua_call(L, lua_gettop(L) - 1, 1);
+        return 1;
+    };
+
+    lua_pushcfunction(_L, main);
+    lua_pushstring(_L, scriptPath);
+
+    for (int i = 0; i < argc; i++) {
+        lua_pushstring(_L, argv[i]);
+    }
+
+    info(TAG "Running \"%s\"", scriptPath);
+    int status = EXIT_FAILURE;
+
+    if (protectedCall(_L, argc + 1, 1, &_logger)) {
+        // The script can return an exit code or a boolean
+        if (lua_isinteger(_L, -1)) {
+            status = static_cast<int>(lua_tointeger(_L, -1));
+        }
+        else if (lua_isboolean(_L, -1)) {
+            status = lua_toboolean(_L, -1) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        else {
+            status = EXIT_SUCCESS;
+        }
+
+        lua_pop(_L, 1);
+    }
+
+    info(TAG "Script finished with status %d", status);
+    _fsm.quit();
+    return status;
+}
+
+int hc::Application::runBenchmark(
+    char const* const corePath,
+    char const* const contentPath,
+    char const* const statePath,
+    unsigned const frames) {
+
+    if (!startHeadless(corePath, contentPath)) {
+        return EXIT_FAILURE;
+    }
+
+    if (statePath != nullptr) {
+        MappedFile state;
+        std::string reason;
+        bool const ok = state.open(statePath, &reason) && lrcpp::Frontend::getInstance().unserialize(state.data(), state.size());
+
+        if (!ok) {
+            error(TAG "Could not load state from \"%s\"", statePath);
+            _fsm.quit();
+            return EXIT_FAILURE;
+        }
+    }
+
+    Benchmark result;
+    bool const ok = benchmark(frames, &result);
+    _fsm.quit();
+
+    if (!ok) {
+        return EXIT_FAILURE;
+    }
+
+    // The text report goes to stderr with the logs so that stdout only has
+    // the JSON one
+    fputs(result.text().c_str(), stderr);
+    printf("%s\n", result.json().c_str());
+    return EXIT_SUCCESS;
+}
+
+bool hc::Application::benchmark(unsigned const frames, Benchmark* const result) {
+    LifeCycle::State const state = _fsm.currentState();
+
+    if (state != LifeCycle::State::GameRunning && state != LifeCycle::State::GamePaused) {
+        error(TAG "A game must be running or paused to be benchmarked");
+        return false;
+    }
+
+    if (_inFrame) {
+        // Running frames from inside a frame would nest run-ahead, the frame
+        // budget and the input latch
+        error(TAG "Can't benchmark from inside a frame");
+        return false;
+    }
+
+    result->start(frames);
+    uint64_t const resample = _audio.resampleTime();
+    uint64_t const begin = Pacer::now();
+
+    for (unsigned i = 0; i < frames; i++) {
+        uint64_t const run = _runPerf.total;
+        uint64_t const video = _video.copyTime();
+        uint64_t const listeners = _framePerf.total;
+
+        runFrame();
+        result->add(_runPerf.total - run, _video.copyTime() - video, _framePerf.total - listeners);
+
+        LifeCycle::State const current = _fsm.currentState();
+
+        if (current != LifeCycle::State::GameRunning && current != LifeCycle::State::GamePaused) {
+            // A listener unloaded the game
+            break;
+        }
+    }
+
+    result->finish(Pacer::now() - begin, _audio.resampleTime() - resample);
+    info(TAG "Benchmarked %zu frames at %.3f fps", result->frames(), result->fps());
+    return true;
+}
+
+bool hc::Application::startHeadless(char const* const corePath, char const* const contentPath) {
+    if (corePath != nullptr && !_fsm.loadCore(corePath)) {
+        error(TAG "Could not load core \"%s\"", corePath);
+        return false;
+    }
+
+    if (contentPath != nullptr) {
+        // Leave the game paused so that it can be stepped
+        if (!_fsm.loadGame(contentPath) || !_fsm.startGame() || !_fsm.pauseGame()) {
+            error(TAG "Could not start content \"%s\"", contentPath);
+            _fsm.quit();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void hc::Application::emulate() {
+    Trace::setThreadName("emulation");
+
+    while (!_done) {
+        uint64_t deadline = 0;
+        uint64_t spin = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(_coreMutex);
+            unsigned count = _pacer.due();
+
+            // A frame can pause or unload the game via Lua
+            while (count-- != 0 && _fsm.currentState() == LifeCycle::State::GameRunning) {
+                runFrame();
+            }
+
+            if (_fsm.currentState() == LifeCycle::State::GameRunning) {
+                deadline = _pacer.next();
+                spin = _pacer.spin();
+            }
+        }
+
+        // Wait outside the lock so the UI can draw in the meantime
+        if (deadline != 0) {
+            Pacer::sleepUntil(deadline, spin);
+
+            if (_pacer.turbo()) {
+                // Frames may be due right away, give the UI a chance to lock
+                std::this_thread::yield();
+            }
+        }
+        else {
+            SDL_Delay(1);
+        }
+    }
+}
+
+bool hc::Application::runFrame() {
+    _inFrame = true;
+
+    bool const turbo = _pacer.turbo();
+    setTurbo(turbo);
+    _video.setTurbo(turbo);
+    _audio.setSpeed(_pacer.speed());
+
+    _input.latch();
+    _frameBudget.frame();
+
+    uint64_t const run = _runPerf.total;
+    uint64_t const video = _video.copyTime();
+
+    _perf.start(&_runPerf);
+    bool const ok = _runAhead.run();
+    _perf.stop(&_runPerf);
+
+    // The video copy happens inside retro_run
+    uint64_t const copy = _video.copyTime() - video;
+    _frameBudget.add(FrameBudget::Phase::Emulation, _runPerf.total - run - copy);
+    _frameBudget.add(FrameBudget::Phase::Video, copy);
+
+    uint64_t const flush = Perf::getTimeNs();
+    _audio.flush();
+
+    if (_headless) {
+        _audio.discard();
+    }
+
+    _frameBudget.add(FrameBudget::Phase::Audio, Perf::getTimeNs() - flush);
+
+    uint64_t const listeners = _framePerf.total;
+    uint64_t const scripts = _control.scriptTime();
+
+    _perf.start(&_framePerf);
+    onFrame();
+    _perf.stop(&_framePerf);
+
+    uint64_t const lua = _control.scriptTime() - scripts;
+    _frameBudget.add(FrameBudget::Phase::Scripts, lua);
+    _frameBudget.add(FrameBudget::Phase::Views, _framePerf.total - listeners - lua);
+
+    _inFrame = false;
+    return ok;
 }
 
 bool hc::Application::loadCore(char const* path) {
@@ -484,18 +776,44 @@ bool hc::Application::loadGame(char const* path) {
     bool ok = false;
 
     if (sysinfo.need_fullpath) {
+        _savestates.setContent(path, nullptr, 0);
         ok = frontend.loadGame(path);
     }
     else {
-        size_t size = 0;
-        void const* data = readAll(&_logger, path, &size);
+        std::string reason;
+        bool mapped = _content.open(path, &reason, true);
+
+        if (mapped && _content.size() == 0) {
+            // Empty files can't be mapped
+            _content.close();
+            mapped = false;
+            reason = "empty file";
+        }
 
-        if (data == nullptr) {
-            return false;
+        if (mapped) {
+            // The mapping is kept until the game is unloaded
+            info(TAG "Mapped content from \"%s\", %zu bytes", path, _content.size());
+            _savestates.setContent(path, _content.data(), _content.size());
+            ok = frontend.loadGame(path, _content.data(), _content.size());
+
+            if (!ok) {
+                _content.close();
+            }
         }
+        else {
+            warn(TAG "Could not map content (%s), reading it instead", reason.c_str());
 
-        ok = frontend.loadGame(path, data, size);
-        free(const_cast<void*>(data));
+            size_t size = 0;
+            void const* data = readAll(&_logger, path, &size);
+
+            if (data == nullptr) {
+                return false;
+            }
+
+            _savestates.setContent(path, data, size);
+            ok = frontend.loadGame(path, data, size);
+            free(const_cast<void*>(data));
+        }
     }
 
     if (!ok) {
@@ -523,7 +841,7 @@ bool hc::Application::loadGame(char const* path) {
     }
 
     if (!any) {
-        info(TAG "    No core memory exposed via the get_memory interface");
+        info(TAG "    No core memory exposed via the get_memory interface, try the State Memory view");
     }
 
     onGameLoaded();
@@ -531,7 +849,6 @@ bool hc::Application::loadGame(char const* path) {
 }
 
 bool hc::Application::pauseGame() {
-    SDL_GL_SetSwapInterval(1);
     onGamePaused();
     return true;
 }
@@ -547,24 +864,17 @@ bool hc::Application::resetGame() {
 }
 
 bool hc::Application::resumeGame() {
-    SDL_GL_SetSwapInterval(0);
     onGameResumed();
     return true;
 }
 
 bool hc::Application::startGame() {
-    SDL_GL_SetSwapInterval(0);
     onGameStarted();
     return true;
 }
 
 bool hc::Application::step() {
-    _perf.start(&_runPerf);
-    bool const ok = lrcpp::Frontend::getInstance().run();
-    _perf.stop(&_runPerf);
-
-    onFrame();
-    return ok;
+    return runFrame();
 }
 
 bool hc::Application::unloadCore() {
@@ -577,11 +887,11 @@ bool hc::Application::unloadCore() {
 }
 
 bool hc::Application::unloadGame() {
-    SDL_GL_SetSwapInterval(1);
-
     if (lrcpp::Frontend::getInstance().unloadGame()) {
+        _content.close();
         onGameUnloaded();
         _runPerf.start = _runPerf.total = _runPerf.call_cnt = 0;
+        _framePerf.start = _framePerf.total = _framePerf.call_cnt = 0;
         return true;
     }
 
@@ -598,30 +908,16 @@ void hc::Application::onCoreLoaded() {
     _runPerf.ident = "hc::retro_run";
     _perf.register_(&_runPerf);
 
+    _framePerf.ident = "hc::onFrame";
+    _perf.register_(&_framePerf);
+
     Desktop::onCoreLoaded();
 }
 
 void hc::Application::onGameLoaded() {
     Desktop::onGameLoaded();
     _coreUsPerFrame = 1000000.0 / _video.getCoreFps();
-}
-
-void hc::Application::onGameStarted() {
-    Desktop::onGameStarted();
-    _runningTime.start();
-    _nextFrameTime = _runningTime.getTimeUs();
-}
-
-void hc::Application::onGamePaused() {
-    Desktop::onGamePaused();
-    _runningTime.pause();
-}
-
-void hc::Application::onGameResumed() {
-    Desktop::onGameResumed();
-
-    _runningTime.resume();
-    _nextFrameTime = _runningTime.getTimeUs() + _coreUsPerFrame;
+    _frameBudget.setBudget(_coreUsPerFrame);
 }
 
 void hc::Application::onDraw() {
@@ -629,11 +925,6 @@ void hc::Application::onDraw() {
     Desktop::onDraw();
 }
 
-void hc::Application::onGameUnloaded() {
-    Desktop::onGameUnloaded();
-    _runningTime.stop();
-}
-
 int hc::Application::push(lua_State* const L) {
     static struct {char const* name; char const* value;} const stringConsts[] = {
         {"_COPYRIGHT", "Copyright (c) 2020-2021 Andre Leiradella"},
@@ -670,9 +961,33 @@ int hc::Application::push(lua_State* const L) {
     _perf.push(L);
     lua_setfield(L, -2, "perf");
 
+    _audio.push(L);
+    lua_setfield(L, -2, "audio");
+
+    _video.push(L);
+    lua_setfield(L, -2, "video");
+
+    _input.push(L);
+    lua_setfield(L, -2, "input");
+
     _control.push(L);
     lua_setfield(L, -2, "control");
 
+    _rewind.push(L);
+    lua_setfield(L, -2, "rewind");
+
+    _runAhead.push(L);
+    lua_setfield(L, -2, "runahead");
+
+    _savestates.push(L);
+    lua_setfield(L, -2, "savestates");
+
+    _stateMemory.push(L);
+    lua_setfield(L, -2, "statememory");
+
+    _metrics.push(L);
+    lua_setfield(L, -2, "metrics");
+
     _memorySelector.push(L);
     lua_setfield(L, -2, "memory");
 
@@ -726,13 +1041,5 @@ void hc::Application::lifeCycleVprintf(void* ud, char const* fmt, va_list args)
 
 void hc::Application::audioCallback(void* const udata, Uint8* const stream, int const len) {
     auto const self = static_cast<Application*>(udata);
-    size_t const avail = self->_fifo.occupied();
-
-    if (avail < (size_t)len) {
-        self->_fifo.read(static_cast<void*>(stream), avail);
-        memset(static_cast<void*>(stream + avail), 0, len - avail);
-    }
-    else {
-        self->_fifo.read(static_cast<void*>(stream), len);
-    }
+    self->_audio.fill(stream, len);
 }
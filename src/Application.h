@@ -10,6 +10,13 @@
 #include "Led.h"
 #include "Input.h"
 #include "Perf.h"
+#include "Pacer.h"
+#include "Rewind.h"
+#include "RunAhead.h"
+#include "Savestates.h"
+#include "StateMemory.h"
+#include "FrameBudget.h"
+#include "Metrics.h"
 
 #include "LifeCycle.h"
 
@@ -20,6 +27,8 @@
 #include "Debugger.h"
 
 #include "Fifo.h"
+#include "MappedFile.h"
+#include "Benchmark.h"
 
 #include <SDL.h>
 #include <SDL_opengl.h>
@@ -29,17 +38,46 @@ extern "C" {
 }
 
 #include <stdarg.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
 
 namespace hc {
     class Application : public Desktop, public Scriptable {
     public:
         Application();
 
-        bool init(std::string const& title, int const width, int const height);
+        bool init(std::string const& title, int const width, int const height, bool const headless);
         void destroy();
         void draw();
         void run();
 
+        // Runs a Lua script without the UI and the emulation thread, after
+        // optionally loading a core and content. Returns the exit status.
+        int runHeadless(
+            char const* const corePath,
+            char const* const contentPath,
+            char const* const scriptPath,
+            int const argc,
+            char const* const* const argv
+        );
+
+        // Runs frames as fast as possible after optionally loading a core,
+        // content and a savestate, and prints the results
+        int runBenchmark(
+            char const* const corePath,
+            char const* const contentPath,
+            char const* const statePath,
+            unsigned const frames
+        );
+
+        // Runs frames back to back, a game must be running or paused and it
+        // can't be called from inside a frame, i.e. from onFrame
+        bool benchmark(unsigned const frames, Benchmark* const result);
+
+        // True while a frame is running
+        bool inFrame() const { return _inFrame; }
+
         // LifeCycle
         bool loadCore(char const* path);
         bool loadGame(char const* path);
@@ -56,11 +94,7 @@ namespace hc {
         virtual char const* getTitle() override;
         virtual void onCoreLoaded() override;
         virtual void onGameLoaded() override;
-        virtual void onGameStarted() override;
-        virtual void onGamePaused() override;
-        virtual void onGameResumed() override;
         virtual void onDraw() override;
-        virtual void onGameUnloaded() override;
 
         // hc::Scriptable
         virtual int push(lua_State* const L) override;
@@ -70,6 +104,11 @@ namespace hc {
         static void lifeCycleVprintf(void* ud, char const* fmt, va_list args);
         static void audioCallback(void* const udata, Uint8* const stream, int const len);
 
+        void emulate();
+        bool runFrame();
+        bool startHeadless(char const* const corePath, char const* const contentPath);
+
+        bool _headless;
         SDL_Window* _window;
         SDL_GLContext _glContext;
         SDL_AudioSpec _audioSpec;
@@ -84,6 +123,13 @@ namespace hc {
         Audio _audio;
         Input _input;
         Perf _perf;
+        Pacer _pacer;
+        Rewind _rewind;
+        RunAhead _runAhead;
+        Savestates _savestates;
+        StateMemory _stateMemory;
+        FrameBudget _frameBudget;
+        Metrics _metrics;
         
         Control _control;
         MemorySelector _memorySelector;
@@ -91,13 +137,26 @@ namespace hc {
         LuaRepl _repl;
         Debugger _debugger;
 
-        Timer _runningTime;
-        uint64_t _nextFrameTime;
         uint64_t _coreUsPerFrame;
 
         retro_perf_counter _runPerf;
+        retro_perf_counter _framePerf;
+
+        // Guards against running frames from listeners of a frame
+        bool _inFrame;
+
+        // The core runs in its own thread. _coreMutex must be held to touch
+        // the core, the Lua state, or to change the life-cycle state, and is
+        // held by the UI thread while the views are drawn.
+        std::thread _emulationThread;
+        std::mutex _coreMutex;
+        std::atomic<bool> _done;
 
         Fifo _fifo;
+
+        // Content is mapped read-only and handed to the core without copies
+        MappedFile _content;
+
         lua_State* _L;
     };
 }
@@ -1,9 +1,17 @@
 #include "Audio.h"
 #include "Logger.h"
+#include "Perf.h"
+#include "Trace.h"
 
 #include <IconsFontAwesome4.h>
 
 #include <float.h>
+#include <math.h>
+#include <inttypes.h>
+
+#ifdef _USE_SSE2
+#include <emmintrin.h>
+#endif
 
 extern "C" {
     #include "lauxlib.h"
@@ -11,167 +19,559 @@ extern "C" {
 
 #define TAG "[AUD] "
 
+static struct {char const* const name; int const quality;} const qualityTiers[] = {
+    {"Fastest", SPEEX_RESAMPLER_QUALITY_MIN},
+    {"VoIP", SPEEX_RESAMPLER_QUALITY_VOIP},
+    {"Default", SPEEX_RESAMPLER_QUALITY_DEFAULT},
+    {"Desktop", SPEEX_RESAMPLER_QUALITY_DESKTOP},
+    {"Best", SPEEX_RESAMPLER_QUALITY_MAX}
+};
+
+static void toFloat(int16_t const* const samples, float* const output, size_t const count) {
+    float const scale = 1.0f / 32768.0f;
+    size_t i = 0;
+
+#ifdef _USE_SSE2
+    __m128 const factor = _mm_set1_ps(scale);
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i const s16 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(samples + i));
+
+        // Sign-extend to 32 bits by placing the samples in the high halves
+        __m128i const lo = _mm_srai_epi32(_mm_unpacklo_epi16(s16, s16), 16);
+        __m128i const hi = _mm_srai_epi32(_mm_unpackhi_epi16(s16, s16), 16);
+
+        _mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), factor));
+        _mm_storeu_ps(output + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), factor));
+    }
+#endif
+
+    for (; i < count; i++) {
+        output[i] = samples[i] * scale;
+    }
+}
+
 hc::Audio::Audio(Desktop* desktop)
     : View(desktop)
     , _sampleRate(0.0)
+    , _deviceFrames(0)
     , _fifo(nullptr)
+    , _speed(1.0)
+    , _speedCredit(0.0)
+    , _discard(false)
+    , _bufferFrames(0)
+    , _droppedFrames(0)
+    , _waveformWindow(0)
     , _mute(false)
     , _wasMuted(false)
     , _rateControlDelta(0.0)
     , _currentRatio(0.0)
     , _originalRatio(0.0)
     , _resampler(nullptr)
+    , _quality(2)
+    , _passThrough(false)
+    , _perf(nullptr)
+    , _resampleTime(0)
+    , _pending(false)
+    , _quit(false)
+    , _pendingQuality(-1)
+    , _capture(desktop)
+    , _captureSource(CaptureResampled)
+    , _captureWav(true)
+    , _active(false)
+    , _underruns(0)
+    , _overruns(0)
+    , _resetOccupancy(false)
+    , _resetHistories(false)
 {
     memset(&_timing, 0, sizeof(_timing));
+    strcpy(_capturePath, "capture.wav");
 }
 
-void hc::Audio::init(double const sampleRate, Fifo* const fifo) {
+void hc::Audio::init(double const sampleRate, size_t const deviceFrames, Fifo* const fifo, Perf* const perf) {
     _sampleRate = sampleRate;
+    _deviceFrames = deviceFrames;
     _fifo = fifo;
+    _perf = perf;
 }
 
-void hc::Audio::flush() {
-    if (_resampler == nullptr) {
-        return;
+void hc::Audio::setSpeed(double const speed) {
+    if (speed != _speed) {
+        _speed = speed;
+        _speedCredit = 0.0;
     }
+}
 
-    _mutex.lock();
-    _previousSamples.swap(_samples);
-    _mutex.unlock();
-    _samples.clear();
+void hc::Audio::setDiscard(bool const discard) {
+    _discard = discard;
+}
 
-    int16_t const* const data = _previousSamples.data();
-    size_t const frames = _previousSamples.size() / 2;
+void hc::Audio::flush() {
+    Trace::Scope scope("Audio::flush");
 
-    size_t const avail = _fifo->free();
+    if (!_workerThread.joinable()) {
+        _batch.frames = 0;
+        return;
+    }
 
-    // Readjust the audio input rate
-    int const halfSize = (int)_fifo->size() / 2;
-    int const deltaMid = (int)avail - halfSize;
-    double const direction = (double)deltaMid / (double)halfSize;
-    double const adjust = 1.0 + _rateControlDelta * direction;
+    // Queue this frame's samples for the worker, silence is queued when muted
+    SampleBuffer& buffer = _batch;
+    size_t const size = buffer.frames * 4;
 
-    _currentRatio = _originalRatio * adjust;
+    // The raw capture gets the core samples even when muted or in turbo mode
+    _capture.write(CaptureRaw, buffer.samples.data(), size);
 
-    spx_uint32_t inLen = frames * 2;
-    spx_uint32_t outLen = (spx_uint32_t)(inLen * _currentRatio);
-    outLen += outLen & 1; // request an even number of samples (stereo)
-    int16_t* const output = (int16_t*)alloca(outLen * 2);
+    // Above normal speed only one out of every _speed frames is played, and
+    // nothing is played at unlimited speed
+    _speedCredit += _speed > 0.0 ? 1.0 / _speed : 0.0;
 
-    if (output == NULL) {
-        _desktop->error(TAG "Error allocating temporary output buffer");
+    if (_speedCredit < 1.0) {
+        buffer.frames = 0;
         return;
     }
 
+    _speedCredit -= 1.0;
+    _speedCredit = _speedCredit < 1.0 ? _speedCredit : 0.0;
+
+    Fifo::Region region;
+    size_t const reserved = _rawFifo.reserveWrite(size, &region);
+
     if (_mute) {
-        memset(output, 0, outLen * 2);
+        memset(region.data[0], 0, region.size[0]);
+        memset(region.data[1], 0, region.size[1]);
     }
     else {
-        int const error = speex_resampler_process_int(_resampler, 0, data, &inLen, output, &outLen);
+        memcpy(region.data[0], buffer.samples.data(), region.size[0]);
+        memcpy(region.data[1], (uint8_t const*)buffer.samples.data() + region.size[0], region.size[1]);
+    }
+
+    _rawFifo.commitWrite(reserved);
+    _droppedFrames += (size - reserved) / 4;
+    buffer.frames = 0;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _pending = true;
+    }
+
+    _gate.notify_one();
+}
+
+void hc::Audio::fill(uint8_t* const stream, size_t const len) {
+    size_t const occupied = _fifo->occupied();
+    size_t const count = _fifo->read(static_cast<void*>(stream), len);
 
-        if (error != RESAMPLER_ERR_SUCCESS) {
-            memset(output, 0, outLen * 2);
-            _desktop->error(TAG "Error resampling: %s", speex_resampler_strerror(error));
+    if (count < len) {
+        memset(static_cast<void*>(stream + count), 0, len - count);
+
+        if (_active.load(std::memory_order_relaxed)) {
+            _underruns.fetch_add(1, std::memory_order_relaxed);
         }
     }
 
-    outLen &= ~1; // don't send incomplete audio frames
-    size_t const size = outLen * 2;
-    _fifo->write(output, size <= avail ? size : avail);
+    if (_resetOccupancy.load(std::memory_order_relaxed) && _resetOccupancy.exchange(false)) {
+        _occupancy.clear();
+    }
+
+    _occupancy.add(static_cast<float>(occupied / FrameSize));
+}
+
+void hc::Audio::discard() {
+    Fifo::Region region;
+    size_t const reserved = _fifo->reserveRead(_fifo->occupied(), &region);
+    _fifo->commitRead(reserved);
+}
+
+void hc::Audio::worker() {
+    Trace::setThreadName("audio");
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _gate.wait(lock, [this]{return _pending || _quit;});
+
+            if (_quit) {
+                return;
+            }
+
+            _pending = false;
+        }
+
+        int const quality = _pendingQuality.exchange(-1);
+
+        if (quality >= 0 && _resampler != nullptr) {
+            speex_resampler_set_quality(_resampler, quality);
+        }
+
+        for (;;) {
+            size_t const frames = readSamples();
+
+            if (frames == 0) {
+                break;
+            }
+
+            resample(frames);
+        }
+    }
+}
+
+size_t hc::Audio::readSamples() {
+    // Both parts hold whole frames since all writes are multiple of 4 bytes
+    Fifo::Region region;
+    size_t const count = _rawFifo.reserveRead(_bufferFrames * 4, &region);
+    size_t const first = region.size[0] / 2;
+
+    _waveform.add((int16_t const*)region.data[0], region.size[0] / 4);
+    _waveform.add((int16_t const*)region.data[1], region.size[1] / 4);
+
+    toFloat((int16_t const*)region.data[0], _input.data(), first);
+    toFloat((int16_t const*)region.data[1], _input.data() + first, region.size[1] / 2);
+
+    _rawFifo.commitRead(count);
+    return count / 4;
+}
+
+void hc::Audio::resample(size_t const frames) {
+    _perf->start(&_resamplePerf);
+
+    double ratio = _originalRatio;
+
+    if (!_passThrough) {
+        // Readjust the audio input rate
+        int const halfSize = (int)_fifo->size() / 2;
+        int const deltaMid = (int)_fifo->free() - halfSize;
+        double const direction = (double)deltaMid / (double)halfSize;
+        double const adjust = 1.0 + _rateControlDelta.load(std::memory_order_relaxed) * direction;
+
+        ratio *= adjust;
+        _currentRatio.store(ratio, std::memory_order_relaxed);
+    }
+
+    size_t const outFrames = _passThrough ? frames : (size_t)(frames * ratio);
+    Fifo::Region region;
+    size_t const reserved = _fifo->reserveWrite(outFrames * FrameSize, &region);
+
+    if (reserved < outFrames * FrameSize) {
+        // The FIFO is full, samples that don't fit are lost
+        _overruns.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (_passThrough) {
+        // Rates match, samples go straight into the ring
+        memcpy(region.data[0], _input.data(), region.size[0]);
+        memcpy(region.data[1], (uint8_t const*)_input.data() + region.size[0], region.size[1]);
+        _capture.write(CaptureResampled, _input.data(), reserved);
+        _fifo->commitWrite(reserved);
+    }
+    else {
+        // Resample directly into the ring, which can wrap around once
+        float const* data = _input.data();
+        spx_uint32_t inLen = frames;
+        size_t written = 0;
+
+        for (unsigned i = 0; i < 2 && region.size[i] != 0; i++) {
+            float* const output = (float*)region.data[i];
+            spx_uint32_t outLen = region.size[i] / FrameSize;
+            spx_uint32_t consumed = inLen;
+
+            int const error = speex_resampler_process_interleaved_float(_resampler, data, &consumed, output, &outLen);
+
+            if (error != RESAMPLER_ERR_SUCCESS) {
+                memset(output, 0, region.size[i]);
+                written += region.size[i];
+                _desktop->error(TAG "Error resampling: %s", speex_resampler_strerror(error));
+                continue;
+            }
+
+            data += consumed * 2;
+            inLen -= consumed;
+            written += outLen * FrameSize;
+
+            if (outLen * FrameSize != region.size[i]) {
+                // Ran out of input, the second part must not be left with a gap
+                break;
+            }
+        }
+
+        size_t const first = written < region.size[0] ? written : region.size[0];
+        _capture.write(CaptureResampled, region.data[0], first);
+        _capture.write(CaptureResampled, region.data[1], written - first);
+        _fifo->commitWrite(written);
+    }
+
+    _perf->stop(&_resamplePerf);
+    _resampleTime.store(_resamplePerf.total, std::memory_order_relaxed);
+
+    // Queued frames plus one device buffer must play before these samples
+    size_t const queued = _fifo->occupied() / FrameSize + _deviceFrames;
+
+    if (_resetHistories.load(std::memory_order_relaxed) && _resetHistories.exchange(false)) {
+        _ratios.clear();
+        _latencies.clear();
+    }
+
+    _ratios.add(static_cast<float>(ratio));
+    _latencies.add(static_cast<float>(queued * 1000.0 / _sampleRate));
+}
+
+void hc::Audio::startWorker() {
+    _pending = false;
+    _quit = false;
+    _pendingQuality = -1;
+    _workerThread = std::thread(&Audio::worker, this);
+}
+
+void hc::Audio::stopWorker() {
+    if (!_workerThread.joinable()) {
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+
+    _gate.notify_one();
+    _workerThread.join();
+}
+
+bool hc::Audio::startCapture(char const* const path, int const source, bool const wav) {
+    if (source == CaptureRaw) {
+        unsigned const rate = static_cast<unsigned>(_timing.sample_rate + 0.5);
+        return _capture.start(path, wav, Capture::Sample::Int16, rate, CaptureRaw);
+    }
+    else {
+        unsigned const rate = static_cast<unsigned>(_sampleRate + 0.5);
+        return _capture.start(path, wav, Capture::Sample::Float32, rate, CaptureResampled);
+    }
+}
+
+hc::Audio* hc::Audio::check(lua_State* const L, int const index) {
+    return *static_cast<Audio**>(luaL_checkudata(L, index, "hc::Audio"));
 }
 
 char const* hc::Audio::getTitle() {
     return ICON_FA_VOLUME_UP " Audio";
 }
 
+void hc::Audio::onCoreLoaded() {
+    // Perf unregisters all counters when a core is unloaded
+    _resamplePerf.ident = "hc::resample";
+    _perf->register_(&_resamplePerf);
+}
+
 void hc::Audio::onGameLoaded() {
     // setSystemAvInfo has been called by now
     _currentRatio = _originalRatio = _sampleRate / _timing.sample_rate;
     _rateControlDelta = 0.005;
 
+    allocateBuffers();
+
+    _underruns = 0;
+    _overruns = 0;
+    _resetOccupancy = true;
+    _ratios.clear();
+    _latencies.clear();
+    _resetHistories = false;
+    _active = true;
+
+    // Rate control can't compensate differences smaller than its delta
+    _passThrough = fabs(_originalRatio - 1.0) <= _rateControlDelta;
+
+    if (_passThrough) {
+        _desktop->info(TAG "Core and device rates match at %f, resampler not needed", _sampleRate);
+        startWorker();
+        return;
+    }
+
+    int const quality = qualityTiers[_quality].quality;
     int error;
-    _resampler = speex_resampler_init(2, _timing.sample_rate, _sampleRate, SPEEX_RESAMPLER_QUALITY_DEFAULT, &error);
+    _resampler = speex_resampler_init(2, _timing.sample_rate, _sampleRate, quality, &error);
 
     if (_resampler == nullptr) {
         _desktop->error(TAG "speex_resampler_init: %s", speex_resampler_strerror(error));
     }
     else {
         _desktop->info(TAG "Resampler initialized to convert from %f to %f", _timing.sample_rate, _sampleRate);
+        startWorker();
     }
 }
 
 void hc::Audio::onGamePaused() {
     _wasMuted = _mute;
     _mute = true;
+
+    // The FIFO drains while paused, don't count that as underruns
+    _active = false;
 }
 
 void hc::Audio::onGameResumed() {
     _mute = _wasMuted;
+    _active = true;
 }
 
 void hc::Audio::onGameReset() {
-    _mutex.lock();
-    _samples.clear();
-    _previousSamples.clear();
-    _drawSamples.clear();
-    _mutex.unlock();
+    clearBuffers();
 }
 
 void hc::Audio::onDraw() {
+    static auto const getter = [](void* const data, int const idx, char const** const text) -> bool {
+        (void)data;
+        *text = qualityTiers[idx].name;
+        return true;
+    };
+
     ImGui::Checkbox("Mute", &_mute);
     ImGui::SameLine();
 
-    static auto const left = [](void* const data, int const idx) -> float {
-        auto const self = static_cast<Audio*>(data);
-        return self->_drawSamples[idx * 2];
-    };
+    int const count = static_cast<int>(sizeof(qualityTiers) / sizeof(qualityTiers[0]));
+    int selected = _quality;
 
-    static auto const right = [](void* data, int idx) -> float {
-        auto const self = static_cast<Audio*>(data);
-        return self->_drawSamples[idx * 2 + 1];
-    };
+    ImGui::PushItemWidth(100.0f);
+    ImGui::Combo("Quality", &selected, getter, nullptr, count);
+    ImGui::PopItemWidth();
+    ImGui::SameLine();
 
-    ImVec2 avail = ImGui::GetContentRegionAvail();
+    if (selected != _quality) {
+        _quality = selected;
 
-    if (avail.y > 0.0f) {
-        avail.x /= 2;
+        if (_resampler != nullptr) {
+            // The worker owns the resampler, let it apply the new quality
+            _pendingQuality = qualityTiers[selected].quality;
+            _desktop->info(TAG "Resampler quality set to %d", qualityTiers[selected].quality);
+        }
+    }
+
+    if (_passThrough) {
+        ImGui::Text("Pass-through");
+        ImGui::SameLine();
+    }
+
+    ImGui::Text("%" PRIu64 " dropped frames", _droppedFrames);
 
-        _mutex.lock();
-        _drawSamples = _previousSamples;
-        _mutex.unlock();
+    ImGui::Text(
+        "Underruns %" PRIu64 ", overruns %" PRIu64 ", latency %.1f ms, ratio %f (%f)",
+        _underruns.load(), _overruns.load(), _latencies.last(), _ratios.last(), _originalRatio
+    );
 
-        int16_t min = INT16_MAX;
-        int16_t max = INT16_MIN;
+    float const width = (ImGui::GetContentRegionAvail().x - ImGui::GetStyle().ItemSpacing.x * 2.0f) / 3.0f;
 
-        size_t const count = _drawSamples.size();
+    drawHistory("Occupancy", _occupancy, static_cast<float>(_fifo->size() / FrameSize), width);
+    ImGui::SameLine();
+    drawHistory("Ratio", _ratios, 0.0f, width);
+    ImGui::SameLine();
+    drawHistory("Latency", _latencies, 0.0f, width);
 
-        for (size_t i = 0; i < count; i++) {
-            int16_t const sample = _drawSamples[i];
-            min = std::min(min, sample);
-            max = std::max(max, sample);
+    static char const* const sources[] = {"Raw", "Resampled"};
+
+    if (_capture.active()) {
+        if (ImGui::Button(ICON_FA_STOP " Stop")) {
+            _capture.stop();
         }
 
-        size_t const size = count / 2;
+        ImGui::SameLine();
+        ImGui::Text(
+            "%s: %" PRIu64 " bytes written, %" PRIu64 " dropped",
+            _capture.path().c_str(), _capture.written(), _capture.dropped()
+        );
+    }
+    else {
+        if (ImGui::Button(ICON_FA_CIRCLE " Record")) {
+            startCapture(_capturePath, _captureSource, _captureWav);
+        }
 
-        ImGui::PlotLines("", left, this, size, 0, nullptr, min, max, avail);
-        ImGui::SameLine(0.0f, 0.0f);
-        ImGui::PlotLines("", right, this, size, 0, nullptr, min, max, avail);
+        ImGui::SameLine();
+        ImGui::PushItemWidth(100.0f);
+        ImGui::Combo("##source", &_captureSource, sources, 2);
+        ImGui::PopItemWidth();
+        ImGui::SameLine();
+        ImGui::Checkbox("WAV", &_captureWav);
+        ImGui::SameLine();
+        ImGui::InputText("##path", _capturePath, sizeof(_capturePath));
+    }
+
+    static struct {char const* const label; double const seconds;} const windows[] = {
+        {"Frame", 0.0},
+        {"100 ms", 0.1},
+        {"1 s", 1.0},
+        {"5 s", 5.0},
+        {"10 s", 10.0}
+    };
+
+    static auto const windowGetter = [](void* const data, int const idx, char const** const text) -> bool {
+        (void)data;
+        *text = windows[idx].label;
+        return true;
+    };
+
+    ImGui::PushItemWidth(100.0f);
+    ImGui::Combo("Window", &_waveformWindow, windowGetter, nullptr, static_cast<int>(sizeof(windows) / sizeof(windows[0])));
+    ImGui::PopItemWidth();
+
+    ImVec2 avail = ImGui::GetContentRegionAvail();
+
+    if (avail.y > 0.0f && _timing.sample_rate > 0.0) {
+        avail.x /= 2;
+
+        double const fps = _timing.fps > 0.0 ? _timing.fps : 60.0;
+        double const seconds = windows[_waveformWindow].seconds;
+        size_t const frames = static_cast<size_t>(_timing.sample_rate * (seconds > 0.0 ? seconds : 1.0 / fps));
 
-        _drawSamples.clear();
+        // Get one column per horizontal pixel for both channels
+        _columns.resize(static_cast<size_t>(avail.x));
+        size_t const count = _waveform.get(frames, _columns.data(), _columns.size());
+
+        drawWaveform(0, count, avail);
+        ImGui::SameLine(0.0f, 0.0f);
+        drawWaveform(1, count, avail);
     }
 }
 
 void hc::Audio::onGameUnloaded() {
+    _active = false;
+    _capture.stop();
+    stopWorker();
+
     if (_resampler != nullptr) {
         speex_resampler_destroy(_resampler);
         _resampler = nullptr;
     }
 
-    _mutex.lock();
-    _samples.clear();
-    _previousSamples.clear();
-    _drawSamples.clear();
-    _mutex.unlock();
+    _passThrough = false;
+    _resamplePerf.start = _resamplePerf.total = _resamplePerf.call_cnt = 0;
+    _resampleTime = 0;
+    std::vector<float>().swap(_input);
+    _rawFifo.destroy();
+
+    std::vector<int16_t>().swap(_batch.samples);
+    std::vector<Waveform::Column>().swap(_columns);
+    _waveform.destroy();
+
+    _bufferFrames = 0;
+    clearBuffers();
+}
+
+int hc::Audio::push(lua_State* const L) {
+    auto const self = static_cast<Audio**>(lua_newuserdata(L, sizeof(Audio*)));
+    *self = this;
+
+    if (luaL_newmetatable(L, "hc::Audio")) {
+        static luaL_Reg const methods[] = {
+            {"stats", l_stats},
+            {"history", l_history},
+            {"setRateControlDelta", l_setRateControlDelta},
+            {"resetStats", l_resetStats},
+            {"startCapture", l_startCapture},
+            {"stopCapture", l_stopCapture},
+            {nullptr, nullptr}
+        };
+
+        luaL_newlib(L, methods);
+        lua_setfield(L, -2, "__index");
+    }
+
+    lua_setmetatable(L, -2);
+    return 1;
 }
 
 bool hc::Audio::setSystemAvInfo(retro_system_av_info const* info) {
@@ -191,16 +591,236 @@ bool hc::Audio::setAudioCallback(retro_audio_callback const* callback) {
 }
 
 size_t hc::Audio::sampleBatch(int16_t const* data, size_t frames) {
-    std::lock_guard<std::mutex> lock(_mutex);
+    if (_discard) {
+        return frames;
+    }
 
-    size_t const size = _samples.size();
-    _samples.resize(size + frames * 2);
-    memcpy(_samples.data() + size, data, frames * 4);
+    SampleBuffer& buffer = _batch;
+    size_t const free = _bufferFrames - buffer.frames;
+    size_t const count = frames <= free ? frames : free;
 
+    if (count != 0) {
+        memcpy(buffer.samples.data() + buffer.frames * 2, data, count * 4);
+        buffer.frames += count;
+    }
+
+    _droppedFrames += frames - count;
     return frames;
 }
 
 void hc::Audio::sample(int16_t left, int16_t right) {
-    int16_t frame[2] = {left, right};
-    sampleBatch(frame, 1);
+    if (_discard) {
+        return;
+    }
+
+    SampleBuffer& buffer = _batch;
+
+    if (buffer.frames < _bufferFrames) {
+        int16_t* const frame = buffer.samples.data() + buffer.frames * 2;
+        frame[0] = left;
+        frame[1] = right;
+        buffer.frames++;
+    }
+    else {
+        _droppedFrames++;
+    }
+}
+
+void hc::Audio::allocateBuffers() {
+    double const fps = _timing.fps > 0.0 ? _timing.fps : 60.0;
+    size_t const frames = (size_t)ceil(_timing.sample_rate / fps) * BufferSlack;
+
+    _bufferFrames = frames > MinBufferFrames ? frames : MinBufferFrames;
+
+    _batch.samples.resize(_bufferFrames * 2);
+    _input.resize(_bufferFrames * 2);
+
+    // The worker isn't running yet, so the wave form can be safely cleared
+    if (!_waveform.init(static_cast<size_t>(_timing.sample_rate * WaveformSeconds))) {
+        _desktop->error(TAG "Error allocating the wave form");
+    }
+
+    // Room for a few buffers, so the worker can fall behind for a while
+    if (!_rawFifo.init(_bufferFrames * 4 * BufferSlack)) {
+        _desktop->error(TAG "Error allocating the sample queue");
+    }
+
+    clearBuffers();
+    _desktop->info(TAG "Sample buffers allocated with %zu frames each", _bufferFrames);
+}
+
+void hc::Audio::clearBuffers() {
+    _batch.frames = 0;
+    _droppedFrames = 0;
+}
+
+void hc::Audio::drawWaveform(unsigned const channel, size_t const count, ImVec2 const& size) {
+    ImVec2 const pos = ImGui::GetCursorScreenPos();
+    ImDrawList* const drawList = ImGui::GetWindowDrawList();
+    ImU32 const color = ImGui::GetColorU32(ImGuiCol_PlotLines);
+
+    float const middle = pos.y + size.y / 2.0f;
+    float const scale = size.y / 65536.0f;
+
+    drawList->AddRectFilled(pos, ImVec2(pos.x + size.x, pos.y + size.y), ImGui::GetColorU32(ImGuiCol_FrameBg));
+
+    // Short windows have fewer buckets than pixels, spread them over the
+    // whole width
+    float const step = count != 0 ? size.x / count : 0.0f;
+
+    for (size_t i = 0; i < count; i++) {
+        Waveform::Column const& column = _columns[i];
+        float const left = pos.x + i * step;
+
+        // Make sure silence still shows as a one pixel line
+        float const top = middle - column.max[channel] * scale;
+        float const bottom = middle - column.min[channel] * scale + 1.0f;
+
+        if (step > 1.0f) {
+            drawList->AddRectFilled(ImVec2(left, top), ImVec2(left + step, bottom), color);
+        }
+        else {
+            float const x = left + 0.5f;
+            drawList->AddLine(ImVec2(x, top), ImVec2(x, bottom), color);
+        }
+    }
+
+    ImGui::Dummy(size);
+}
+
+void hc::Audio::drawHistory(char const* const label, History<HistorySize> const& history, float const max, float const width) {
+    static auto const getter = [](void* const data, int const idx) -> float {
+        auto const history = static_cast<History<HistorySize> const*>(data);
+        return history->get(idx);
+    };
+
+    void* const data = const_cast<History<HistorySize>*>(&history);
+    int const count = static_cast<int>(history.size());
+
+    // A max of zero lets ImGui scale the plot to the values
+    float const scaleMax = max > 0.0f ? max : FLT_MAX;
+    float const scaleMin = max > 0.0f ? 0.0f : FLT_MAX;
+
+    ImGui::PlotLines("", getter, data, count, 0, label, scaleMin, scaleMax, ImVec2(width, 40.0f));
+}
+
+hc::Audio::Health hc::Audio::health() const {
+    Health health;
+
+    health.underruns = _underruns.load();
+    health.overruns = _overruns.load();
+    health.droppedFrames = _droppedFrames;
+    health.occupancy = static_cast<size_t>(_occupancy.last());
+    health.capacity = _fifo->size() / FrameSize;
+    health.latency = _latencies.last();
+    health.ratio = _currentRatio.load();
+
+    return health;
+}
+
+int hc::Audio::l_stats(lua_State* const L) {
+    auto const self = check(L, 1);
+
+    lua_createtable(L, 0, 12);
+
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_underruns.load()));
+    lua_setfield(L, -2, "underruns");
+
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_overruns.load()));
+    lua_setfield(L, -2, "overruns");
+
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_droppedFrames));
+    lua_setfield(L, -2, "droppedFrames");
+
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_occupancy.last()));
+    lua_setfield(L, -2, "occupancy");
+
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_fifo->size() / FrameSize));
+    lua_setfield(L, -2, "capacity");
+
+    lua_pushnumber(L, self->_latencies.last());
+    lua_setfield(L, -2, "latency");
+
+    lua_pushnumber(L, self->_currentRatio.load());
+    lua_setfield(L, -2, "currentRatio");
+
+    lua_pushnumber(L, self->_originalRatio);
+    lua_setfield(L, -2, "originalRatio");
+
+    lua_pushnumber(L, self->_rateControlDelta.load());
+    lua_setfield(L, -2, "rateControlDelta");
+
+    lua_pushboolean(L, self->_capture.active());
+    lua_setfield(L, -2, "capturing");
+
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_capture.written()));
+    lua_setfield(L, -2, "captureBytes");
+
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_capture.dropped()));
+    lua_setfield(L, -2, "captureDropped");
+
+    return 1;
+}
+
+int hc::Audio::l_history(lua_State* const L) {
+    static char const* const names[] = {"occupancy", "ratio", "latency", nullptr};
+
+    auto const self = check(L, 1);
+    int const which = luaL_checkoption(L, 2, nullptr, names);
+
+    History<HistorySize> const* const histories[] = {&self->_occupancy, &self->_ratios, &self->_latencies};
+    History<HistorySize> const* const history = histories[which];
+
+    size_t const count = history->size();
+    lua_createtable(L, static_cast<int>(count), 0);
+
+    for (size_t i = 0; i < count; i++) {
+        lua_pushnumber(L, history->get(i));
+        lua_rawseti(L, -2, static_cast<lua_Integer>(i + 1));
+    }
+
+    return 1;
+}
+
+int hc::Audio::l_setRateControlDelta(lua_State* const L) {
+    auto const self = check(L, 1);
+    lua_Number const delta = luaL_checknumber(L, 2);
+
+    if (delta < 0.0 || delta > 0.5) {
+        return luaL_error(L, "invalid rate control delta %f", delta);
+    }
+
+    self->_rateControlDelta = delta;
+    return 0;
+}
+
+int hc::Audio::l_resetStats(lua_State* const L) {
+    auto const self = check(L, 1);
+
+    self->_underruns = 0;
+    self->_overruns = 0;
+
+    // The histories are cleared by the threads that write to them
+    self->_resetOccupancy = true;
+    self->_resetHistories = true;
+    return 0;
+}
+
+int hc::Audio::l_startCapture(lua_State* const L) {
+    static char const* const sources[] = {"raw", "resampled", nullptr};
+    static char const* const formats[] = {"raw", "wav", nullptr};
+
+    auto const self = check(L, 1);
+    char const* const path = luaL_checkstring(L, 2);
+    int const source = luaL_checkoption(L, 3, "resampled", sources);
+    int const format = luaL_checkoption(L, 4, "wav", formats);
+
+    lua_pushboolean(L, self->startCapture(path, source == 0 ? CaptureRaw : CaptureResampled, format == 1));
+    return 1;
+}
+
+int hc::Audio::l_stopCapture(lua_State* const L) {
+    auto const self = check(L, 1);
+    self->_capture.stop();
+    return 0;
 }
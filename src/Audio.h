@@ -1,26 +1,68 @@
 #pragma once
 
 #include "Desktop.h"
+#include "Scriptable.h"
+#include "Capture.h"
+#include "Waveform.h"
 
 #include <lrcpp/Components.h>
+#include <imgui.h>
 #include <Fifo.h>
 
 #include <speex_resampler.h>
 
 #include <vector>
+#include <atomic>
+#include <thread>
 #include <mutex>
+#include <condition_variable>
 
 namespace hc {
-    class Audio: public View, public lrcpp::Audio {
+    class Audio: public View, public Scriptable, public lrcpp::Audio {
     public:
         Audio(Desktop* desktop);
         virtual ~Audio() {}
 
-        void init(double const sampleRate, Fifo* const fifo);
+        void init(double const sampleRate, size_t const deviceFrames, Fifo* const fifo, Perf* const perf);
         void flush();
 
+        // Audio of frames run faster than real time is dropped to keep the
+        // FIFO from overflowing, must be called from the emulation thread
+        void setSpeed(double const speed);
+
+        // Samples are thrown away as they arrive while discarding, must be
+        // called from the emulation thread
+        void setDiscard(bool const discard);
+
+        // Called from the audio device thread to get samples to play
+        void fill(uint8_t* const stream, size_t const len);
+
+        // Null sink used when there's no audio device, throws away all the
+        // resampled audio
+        void discard();
+
+        // Total time spent resampling by the worker, in nanoseconds
+        uint64_t resampleTime() const { return _resampleTime.load(std::memory_order_relaxed); }
+
+        // The same statistics hc.audio:stats returns, latency is in
+        // milliseconds. Must be called with the core mutex held
+        struct Health {
+            uint64_t underruns;
+            uint64_t overruns;
+            uint64_t droppedFrames;
+            size_t occupancy;
+            size_t capacity;
+            double latency;
+            double ratio;
+        };
+
+        Health health() const;
+
+        static Audio* check(lua_State* const L, int const index);
+
         // hc::View
         virtual char const* getTitle() override;
+        virtual void onCoreLoaded() override;
         virtual void onGameLoaded() override;
         virtual void onGamePaused() override;
         virtual void onGameResumed() override;
@@ -28,6 +70,9 @@ namespace hc {
         virtual void onDraw() override;
         virtual void onGameUnloaded() override;
 
+        // hc::Scriptable
+        virtual int push(lua_State* const L) override;
+
         // lrcpp::Audio
         virtual bool setSystemAvInfo(retro_system_av_info const* info) override;
         virtual bool setAudioCallback(retro_audio_callback const* callback) override;
@@ -36,22 +81,146 @@ namespace hc {
         virtual void sample(int16_t left, int16_t right) override;
 
     protected:
+        enum {
+            // Never allocate buffers smaller than this number of frames
+            MinBufferFrames = 1024,
+            // How many video frames worth of audio each buffer can hold
+            BufferSlack = 4,
+            // Samples are sent to the device as interleaved stereo floats
+            FrameSize = 2 * sizeof(float),
+            // Number of entries kept in the instrumentation histories
+            HistorySize = 256,
+            // Streams that can be captured to disk
+            CaptureRaw = 0,
+            CaptureResampled = 1,
+            // Seconds of audio kept for the wave form
+            WaveformSeconds = 10
+        };
+
+        // Fixed-size history of values, written by a single thread and
+        // readable from any thread
+        template<size_t N>
+        class History {
+        public:
+            History() : _count(0) {}
+
+            void clear() {
+                _count.store(0, std::memory_order_release);
+            }
+
+            void add(float const value) {
+                size_t const count = _count.load(std::memory_order_relaxed);
+                _values[count % N].store(value, std::memory_order_relaxed);
+                _count.store(count + 1, std::memory_order_release);
+            }
+
+            size_t size() const {
+                size_t const count = _count.load(std::memory_order_acquire);
+                return count < N ? count : N;
+            }
+
+            // Index 0 is the oldest value in the history
+            float get(size_t const index) const {
+                size_t const count = _count.load(std::memory_order_acquire);
+                size_t const first = count < N ? 0 : count - N;
+                return _values[(first + index) % N].load(std::memory_order_relaxed);
+            }
+
+            float last() const {
+                size_t const count = _count.load(std::memory_order_acquire);
+                return count == 0 ? 0.0f : _values[(count - 1) % N].load(std::memory_order_relaxed);
+            }
+
+        protected:
+            std::atomic<float> _values[N];
+            std::atomic<size_t> _count;
+        };
+
+        // Preallocated interleaved stereo samples received in one video frame
+        struct SampleBuffer {
+            std::vector<int16_t> samples;
+            size_t frames;
+        };
+
+        void allocateBuffers();
+        void clearBuffers();
+
+        void worker();
+        size_t readSamples();
+        void resample(size_t const frames);
+        void startWorker();
+        void stopWorker();
+        bool startCapture(char const* const path, int const source, bool const wav);
+
+        void drawWaveform(unsigned const channel, size_t const count, ImVec2 const& size);
+        void drawHistory(char const* const label, History<HistorySize> const& history, float const max, float const width);
+
+        static int l_stats(lua_State* const L);
+        static int l_history(lua_State* const L);
+        static int l_setRateControlDelta(lua_State* const L);
+        static int l_resetStats(lua_State* const L);
+        static int l_startCapture(lua_State* const L);
+        static int l_stopCapture(lua_State* const L);
+
         double _sampleRate;
+        size_t _deviceFrames;
         Fifo* _fifo;
 
-        std::vector<int16_t> _samples;
-        std::mutex _mutex;
+        // Samples received from the core in the current video frame
+        SampleBuffer _batch;
+        double _speed;
+        double _speedCredit;
+        bool _discard;
+        size_t _bufferFrames;
+        uint64_t _droppedFrames;
+
+        // Built by the worker, drawn by the view
+        Waveform _waveform;
+        std::vector<Waveform::Column> _columns;
+        int _waveformWindow;
 
         retro_system_timing _timing;
         bool _mute;
         bool _wasMuted;
 
-        double _rateControlDelta;
-        double _currentRatio;
+        std::atomic<double> _rateControlDelta;
+        std::atomic<double> _currentRatio;
         double _originalRatio;
         SpeexResamplerState* _resampler;
+        int _quality;
+        bool _passThrough;
+        std::vector<float> _input;
+
+        Perf* _perf;
+        retro_perf_counter _resamplePerf;
+        std::atomic<uint64_t> _resampleTime;
+
+        // The worker thread takes raw samples from _rawFifo, resamples them
+        // and writes the result to _fifo
+        Fifo _rawFifo;
+        std::thread _workerThread;
+        std::mutex _mutex;
+        std::condition_variable _gate;
+        bool _pending;
+        bool _quit;
+        std::atomic<int> _pendingQuality;
+
+        Capture _capture;
+        char _capturePath[256];
+        int _captureSource;
+        bool _captureWav;
+
+        // Instrumentation, occupancy and underruns are written by fill
+        std::atomic<bool> _active;
+        std::atomic<uint64_t> _underruns;
+        std::atomic<uint64_t> _overruns;
+        History<HistorySize> _occupancy;
+        History<HistorySize> _ratios;
+        History<HistorySize> _latencies;
 
-        std::vector<int16_t> _previousSamples;
-        std::vector<int16_t> _drawSamples;
+        // Requests to clear the histories, honored by the threads that add
+        // to them: fill for _occupancy and the worker for the others
+        std::atomic<bool> _resetOccupancy;
+        std::atomic<bool> _resetHistories;
     };
 }
@@ -0,0 +1,170 @@
+#include "Benchmark.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <algorithm>
+
+void hc::Benchmark::start(size_t const frames) {
+    _run.clear();
+    _video.clear();
+    _listeners.clear();
+
+    _run.reserve(frames);
+    _video.reserve(frames);
+    _listeners.reserve(frames);
+
+    _elapsed = _resample = 0;
+}
+
+void hc::Benchmark::add(uint64_t const run, uint64_t const video, uint64_t const listeners) {
+    _run.push_back(run);
+    _video.push_back(video);
+    _listeners.push_back(listeners);
+}
+
+void hc::Benchmark::finish(uint64_t const elapsed, uint64_t const resample) {
+    _elapsed = elapsed;
+    _resample = resample;
+}
+
+double hc::Benchmark::fps() const {
+    return _elapsed != 0 ? _run.size() * 1000000000.0 / _elapsed : 0.0;
+}
+
+std::string hc::Benchmark::text() const {
+    static char const* const names[] = {"retro_run", "video", "onFrame"};
+    std::vector<uint64_t> const* const samples[] = {&_run, &_video, &_listeners};
+
+    char line[256];
+    std::string result;
+
+    snprintf(
+        line, sizeof(line), "%zu frames in %.3f s, %.3f fps\n",
+        _run.size(), _elapsed / 1000000000.0, fps()
+    );
+
+    result += line;
+    result += "             mean (us)   p50 (us)   p99 (us)   max (us)\n";
+
+    for (unsigned i = 0; i < 3; i++) {
+        Stats const s = stats(*samples[i]);
+
+        snprintf(
+            line, sizeof(line), "%-10s %11.3f %10.3f %10.3f %10.3f\n",
+            names[i], s.mean / 1000.0, s.p50 / 1000.0, s.p99 / 1000.0, s.max / 1000.0
+        );
+
+        result += line;
+    }
+
+    double const resampleMean = _run.empty() ? 0.0 : static_cast<double>(_resample) / _run.size();
+    snprintf(line, sizeof(line), "%-10s %11.3f (total %.3f ms)\n", "resample", resampleMean / 1000.0, _resample / 1000000.0);
+    result += line;
+
+    return result;
+}
+
+std::string hc::Benchmark::json() const {
+    static char const* const names[] = {"retro_run", "video", "onFrame"};
+    std::vector<uint64_t> const* const samples[] = {&_run, &_video, &_listeners};
+
+    char line[256];
+    std::string result;
+
+    snprintf(
+        line, sizeof(line), "{\"frames\":%zu,\"elapsed_ns\":%" PRIu64 ",\"fps\":%.3f",
+        _run.size(), _elapsed, fps()
+    );
+
+    result += line;
+
+    for (unsigned i = 0; i < 3; i++) {
+        Stats const s = stats(*samples[i]);
+
+        snprintf(
+            line, sizeof(line),
+            ",\"%s\":{\"mean_ns\":%.1f,\"p50_ns\":%" PRIu64 ",\"p99_ns\":%" PRIu64 ",\"max_ns\":%" PRIu64 "}",
+            names[i], s.mean, s.p50, s.p99, s.max
+        );
+
+        result += line;
+    }
+
+    double const resampleMean = _run.empty() ? 0.0 : static_cast<double>(_resample) / _run.size();
+    snprintf(line, sizeof(line), ",\"resample\":{\"mean_ns\":%.1f,\"total_ns\":%" PRIu64 "}}", resampleMean, _resample);
+    result += line;
+
+    return result;
+}
+
+void hc::Benchmark::push(lua_State* const L) const {
+    static char const* const names[] = {"run", "video", "onFrame"};
+    std::vector<uint64_t> const* const samples[] = {&_run, &_video, &_listeners};
+
+    lua_createtable(L, 0, 10);
+
+    lua_pushinteger(L, static_cast<lua_Integer>(_run.size()));
+    lua_setfield(L, -2, "frames");
+
+    lua_pushinteger(L, static_cast<lua_Integer>(_elapsed));
+    lua_setfield(L, -2, "elapsed");
+
+    lua_pushnumber(L, fps());
+    lua_setfield(L, -2, "fps");
+
+    for (unsigned i = 0; i < 3; i++) {
+        Stats const s = stats(*samples[i]);
+        lua_createtable(L, 0, 4);
+
+        lua_pushnumber(L, s.mean);
+        lua_setfield(L, -2, "mean");
+
+        lua_pushinteger(L, static_cast<lua_Integer>(s.p50));
+        lua_setfield(L, -2, "p50");
+
+        lua_pushinteger(L, static_cast<lua_Integer>(s.p99));
+        lua_setfield(L, -2, "p99");
+
+        lua_pushinteger(L, static_cast<lua_Integer>(s.max));
+        lua_setfield(L, -2, "max");
+
+        lua_setfield(L, -2, names[i]);
+    }
+
+    lua_pushinteger(L, static_cast<lua_Integer>(_resample));
+    lua_setfield(L, -2, "resample");
+
+    std::string const& report = text();
+    lua_pushlstring(L, report.c_str(), report.length());
+    lua_setfield(L, -2, "text");
+
+    std::string const& encoded = json();
+    lua_pushlstring(L, encoded.c_str(), encoded.length());
+    lua_setfield(L, -2, "json");
+}
+
+hc::Benchmark::Stats hc::Benchmark::stats(std::vector<uint64_t> const& samples) {
+    Stats s = {0.0, 0, 0, 0};
+
+    if (samples.empty()) {
+        return s;
+    }
+
+    std::vector<uint64_t> sorted(samples);
+    std::sort(sorted.begin(), sorted.end());
+
+    uint64_t total = 0;
+
+    for (auto const sample : sorted) {
+        total += sample;
+    }
+
+    size_t const count = sorted.size();
+
+    // Nearest-rank percentiles
+    s.mean = static_cast<double>(total) / count;
+    s.p50 = sorted[(count * 50 + 99) / 100 - 1];
+    s.p99 = sorted[(count * 99 + 99) / 100 - 1];
+    s.max = sorted[count - 1];
+    return s;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+extern "C" {
+    #include <lua.h>
+}
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace hc {
+    // Collects per-frame timings of a benchmark run and reports them as text,
+    // JSON or a Lua table. All times are in nanoseconds.
+    class Benchmark final {
+    public:
+        struct Stats {
+            double mean;
+            uint64_t p50;
+            uint64_t p99;
+            uint64_t max;
+        };
+
+        void start(size_t const frames);
+
+        // Time spent in retro_run, copying the video frame out of the core,
+        // and in the onFrame listeners for one frame
+        void add(uint64_t const run, uint64_t const video, uint64_t const listeners);
+
+        // Total wall time and time spent resampling audio in the worker
+        void finish(uint64_t const elapsed, uint64_t const resample);
+
+        size_t frames() const { return _run.size(); }
+        double fps() const;
+
+        std::string text() const;
+        std::string json() const;
+
+        // Pushes a table with the results, including the text and JSON reports
+        void push(lua_State* const L) const;
+
+    protected:
+        static Stats stats(std::vector<uint64_t> const& samples);
+
+        std::vector<uint64_t> _run;
+        std::vector<uint64_t> _video;
+        std::vector<uint64_t> _listeners;
+        uint64_t _elapsed;
+        uint64_t _resample;
+    };
+}
@@ -0,0 +1,199 @@
+#include "Capture.h"
+#include "Trace.h"
+
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <chrono>
+
+#define TAG "[CAP] "
+
+static void put16(uint8_t* const p, uint32_t const value) {
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+}
+
+static void put32(uint8_t* const p, uint32_t const value) {
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+hc::Capture::Capture(Desktop* desktop)
+    : _desktop(desktop)
+    , _file(nullptr)
+    , _wav(true)
+    , _sample(Sample::Int16)
+    , _rate(0)
+    , _quit(false)
+    , _active(false)
+    , _source(-1)
+    , _writers(0)
+    , _written(0)
+    , _dropped(0)
+{}
+
+hc::Capture::~Capture() {
+    stop();
+}
+
+bool hc::Capture::start(char const* const path, bool const wav, Sample const sample, unsigned const rate, int const source) {
+    stop();
+
+    if (!_ring.init(RingSize)) {
+        _desktop->error(TAG "Error allocating the capture ring");
+        return false;
+    }
+
+    _file = fopen(path, "wb");
+
+    if (_file == nullptr) {
+        _desktop->error(TAG "Error opening \"%s\": %s", path, strerror(errno));
+        _ring.destroy();
+        return false;
+    }
+
+    // Chunks are already big, don't copy them again into the stdio buffer
+    setvbuf(_file, nullptr, _IONBF, 0);
+
+    _path = path;
+    _wav = wav;
+    _sample = sample;
+    _rate = rate;
+    _quit = false;
+    _written = 0;
+    _dropped = 0;
+
+    if (_wav && !writeHeader(0)) {
+        fclose(_file);
+        _file = nullptr;
+        _ring.destroy();
+        return false;
+    }
+
+    _thread = std::thread(&Capture::writer, this);
+    _source = source;
+    _active = true;
+
+    _desktop->info(TAG "Capturing audio to \"%s\"", path);
+    return true;
+}
+
+void hc::Capture::stop() {
+    if (!_thread.joinable()) {
+        return;
+    }
+
+    // Wait for the producer to leave write before tearing the ring down
+    _active = false;
+
+    while (_writers != 0) {
+        std::this_thread::yield();
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+
+    _gate.notify_one();
+    _thread.join();
+
+    if (_wav) {
+        writeHeader(_written);
+    }
+
+    fclose(_file);
+    _file = nullptr;
+    _ring.destroy();
+
+    _desktop->info(
+        TAG "Audio capture to \"%s\" finished, %" PRIu64 " bytes written, %" PRIu64 " bytes dropped",
+        _path.c_str(), _written.load(), _dropped.load()
+    );
+}
+
+void hc::Capture::write(int const source, void const* const data, size_t const size) {
+    _writers++;
+
+    if (_active && _source == source) {
+        size_t const count = _ring.write(data, size);
+
+        if (count < size) {
+            _dropped.fetch_add(size - count, std::memory_order_relaxed);
+        }
+    }
+
+    _writers--;
+}
+
+void hc::Capture::writer() {
+    Trace::setThreadName("capture");
+
+    for (;;) {
+        bool quit;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _gate.wait_for(lock, std::chrono::milliseconds(PollInterval), [this]{return _quit;});
+            quit = _quit;
+        }
+
+        // The ring size is a multiple of the chunk size, so full chunks are
+        // always contiguous and the file is written in ChunkSize units
+        while (_ring.occupied() >= ChunkSize) {
+            if (!writeChunk(ChunkSize)) {
+                return;
+            }
+        }
+
+        if (quit) {
+            writeChunk(_ring.occupied());
+            return;
+        }
+    }
+}
+
+bool hc::Capture::writeChunk(size_t const size) {
+    Fifo::Region region;
+    size_t const count = _ring.reserveRead(size, &region);
+
+    for (unsigned i = 0; i < 2; i++) {
+        if (region.size[i] != 0 && fwrite(region.data[i], 1, region.size[i], _file) != region.size[i]) {
+            _desktop->error(TAG "Error writing to \"%s\": %s", _path.c_str(), strerror(errno));
+            return false;
+        }
+    }
+
+    _ring.commitRead(count);
+    _written.fetch_add(count, std::memory_order_relaxed);
+    return true;
+}
+
+bool hc::Capture::writeHeader(uint64_t const dataSize) {
+    // Sizes are clamped, players will still read files bigger than 4 GiB
+    uint32_t const size = dataSize <= 0xffffffffULL - 36 ? static_cast<uint32_t>(dataSize) : static_cast<uint32_t>(0xffffffffULL - 36);
+    unsigned const bytesPerSample = _sample == Sample::Int16 ? 2 : 4;
+
+    uint8_t header[44];
+    memcpy(header, "RIFF", 4);
+    put32(header + 4, 36 + size);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put32(header + 16, 16);
+    put16(header + 20, _sample == Sample::Int16 ? 1 : 3); // PCM or IEEE float
+    put16(header + 22, 2);
+    put32(header + 24, _rate);
+    put32(header + 28, _rate * 2 * bytesPerSample);
+    put16(header + 32, 2 * bytesPerSample);
+    put16(header + 34, bytesPerSample * 8);
+    memcpy(header + 36, "data", 4);
+    put32(header + 40, size);
+
+    if (fseek(_file, 0, SEEK_SET) != 0 || fwrite(header, 1, sizeof(header), _file) != sizeof(header)) {
+        _desktop->error(TAG "Error writing the WAV header to \"%s\": %s", _path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "Desktop.h"
+#include "Fifo.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+
+namespace hc {
+    // Streams audio samples to a WAV or raw file. Samples are queued by a
+    // single producer thread without blocking, and written to disk by a
+    // dedicated I/O thread.
+    class Capture final {
+    public:
+        enum class Sample {
+            Int16,
+            Float32
+        };
+
+        Capture(Desktop* desktop);
+        ~Capture();
+
+        // Only writes tagged with source are captured, so that producers of
+        // different streams can share the same Capture
+        bool start(char const* const path, bool const wav, Sample const sample, unsigned const rate, int const source);
+        void stop();
+
+        // Called from the producer thread, samples are dropped if the I/O
+        // thread falls too far behind
+        void write(int const source, void const* const data, size_t const size);
+
+        bool active() const { return _active.load(std::memory_order_relaxed); }
+        int source() const { return _source.load(std::memory_order_relaxed); }
+        std::string const& path() const { return _path; }
+        uint64_t written() const { return _written.load(std::memory_order_relaxed); }
+        uint64_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+    protected:
+        enum {
+            // Bytes queued before the I/O thread gives up and drops samples
+            RingSize = 8 * 1024 * 1024,
+            // Size of the writes issued to the file
+            ChunkSize = 64 * 1024,
+            // How often the I/O thread checks the ring, in milliseconds
+            PollInterval = 20
+        };
+
+        void writer();
+        bool writeChunk(size_t const size);
+        bool writeHeader(uint64_t const dataSize);
+
+        Desktop* _desktop;
+
+        FILE* _file;
+        std::string _path;
+        bool _wav;
+        Sample _sample;
+        unsigned _rate;
+
+        Fifo _ring;
+        std::thread _thread;
+        std::mutex _mutex;
+        std::condition_variable _gate;
+        bool _quit;
+
+        // _writers counts producers inside write, so that stop knows when
+        // it's safe to destroy the ring
+        std::atomic<bool> _active;
+        std::atomic<int> _source;
+        std::atomic<int> _writers;
+        std::atomic<uint64_t> _written;
+        std::atomic<uint64_t> _dropped;
+    };
+}
@@ -151,6 +151,10 @@ bool hc::Config::getSupportNoGame() const {
     return _supportsNoGame;
 }
 
+uint64_t hc::Config::getSerializationQuirks() const {
+    return _serializationQuirks;
+}
+
 const std::string& hc::Config::getRootPath() const {
     return _rootPath;
 }
@@ -159,6 +163,10 @@ const std::string& hc::Config::getScriptsPath() const {
     return _scriptsPath;
 }
 
+const std::string& hc::Config::getSavePath() const {
+    return _savePath;
+}
+
 retro_proc_address_t hc::Config::getExtension(char const* const symbol) {
     return _getCoreProc != nullptr ? _getCoreProc(symbol) : nullptr;
 }
@@ -54,8 +54,10 @@ namespace hc {
 
         bool init();
         bool getSupportNoGame() const;
+        uint64_t getSerializationQuirks() const;
         std::string const& getRootPath() const;
         std::string const& getScriptsPath() const;
+        std::string const& getSavePath() const;
         retro_proc_address_t getExtension(char const* const symbol);
 
         static Config* check(lua_State* const L, int const index);
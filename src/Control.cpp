@@ -1,5 +1,7 @@
 #include "Control.h"
+#include "Application.h"
 #include "Logger.h"
+#include "Perf.h"
 
 #include "LuaUtil.h"
 
@@ -40,11 +42,13 @@ static int str2id(char const* const str) {
     }
 }
 
-hc::Control::Control(Desktop* desktop) : View(desktop),  _selected(0), _opened(-1) {}
+hc::Control::Control(Desktop* desktop) : View(desktop),  _selected(0), _opened(-1), _scriptTime(0) {}
 
-void hc::Control::init(LifeCycle* const fsm, Logger* const logger) {
+void hc::Control::init(Application* const app, LifeCycle* const fsm, Logger* const logger, Pacer* const pacer) {
+    _app = app;
     _fsm = fsm;
     _logger = logger;
+    _pacer = pacer;
 }
 
 char const* hc::Control::getTitle() {
@@ -76,7 +80,9 @@ void hc::Control::onGameReset() {
 }
 
 void hc::Control::onFrame() {
+    uint64_t const begin = Perf::getTimeNs();
     callConsoleMethod("onFrame");
+    _scriptTime += Perf::getTimeNs() - begin;
 }
 
 void hc::Control::onStep() {
@@ -191,6 +197,27 @@ void hc::Control::onDraw() {
     if (ImGuiAl::Button(ICON_FA_POWER_OFF " Unload Console", _fsm->canTransitionTo(LifeCycle::State::Start), size)) {
         _fsm->unloadCore();
     }
+
+    static char const* const labels[] = {"0.5x", "1x", "2x", "4x", "8x", "Unlimited"};
+    static double const speeds[] = {0.5, 1.0, 2.0, 4.0, 8.0, 0.0};
+    enum { NumSpeeds = sizeof(speeds) / sizeof(speeds[0]) };
+
+    // Speeds set via Lua may not be in the list
+    int current = -1;
+
+    for (int i = 0; i < NumSpeeds; i++) {
+        if (speeds[i] == _pacer->speed()) {
+            current = i;
+            break;
+        }
+    }
+
+    int selected = current;
+    ImGui::Combo(ICON_FA_FORWARD " Speed", &selected, labels, NumSpeeds);
+
+    if (selected != current) {
+        _pacer->setSpeed(speeds[selected]);
+    }
 }
 
 void hc::Control::onGameUnloaded() {
@@ -235,6 +262,11 @@ void hc::Control::setSystemInfo(retro_system_info const* info) {
 }
 
 void hc::Control::callConsoleMethod(char const* const name) {
+    if (_opened < 0) {
+        // The core wasn't loaded via a console, i.e. from Lua or in headless mode
+        return;
+    }
+
     auto const& cb = _consoles[_opened];
     lua_rawgeti(cb.L, LUA_REGISTRYINDEX, cb.ref);
     protectedCallField(cb.L, -1, name, 0, 0, _logger);
@@ -268,6 +300,9 @@ int hc::Control::push(lua_State* const L) {
             {"getRegion", l_getRegion},
             {"getMemoryData", l_getMemoryData},
             {"getMemorySize", l_getMemorySize},
+            {"setSpeed", l_setSpeed},
+            {"getSpeed", l_getSpeed},
+            {"benchmark", l_benchmark},
             {nullptr, nullptr}
         };
 
@@ -624,3 +659,43 @@ int hc::Control::l_getMemorySize(lua_State* const L) {
     lua_pushinteger(L, size);
     return 1;
 }
+
+int hc::Control::l_setSpeed(lua_State* const L) {
+    auto const self = check(L, 1);
+    lua_Number const speed = luaL_checknumber(L, 2);
+
+    if (speed < 0.0) {
+        return luaL_error(L, "invalid speed %f", speed);
+    }
+
+    self->_pacer->setSpeed(speed);
+    return 0;
+}
+
+int hc::Control::l_getSpeed(lua_State* const L) {
+    auto const self = check(L, 1);
+    lua_pushnumber(L, self->_pacer->speed());
+    return 1;
+}
+
+int hc::Control::l_benchmark(lua_State* const L) {
+    auto const self = check(L, 1);
+    lua_Integer const frames = luaL_checkinteger(L, 2);
+
+    if (frames <= 0) {
+        return luaL_error(L, "invalid number of frames %I", frames);
+    }
+
+    if (self->_app->inFrame()) {
+        return luaL_error(L, "benchmark can't be called from inside a frame");
+    }
+
+    Benchmark result;
+
+    if (!self->_app->benchmark(static_cast<unsigned>(frames), &result)) {
+        return luaL_error(L, "could not run the benchmark");
+    }
+
+    result.push(L);
+    return 1;
+}
@@ -3,16 +3,19 @@
 #include "Desktop.h"
 #include "LifeCycle.h"
 #include "Scriptable.h"
+#include "Pacer.h"
 
 #include <string>
 #include <vector>
 
 namespace hc {
+    class Application;
+
     class Control : public View, public Scriptable {
     public:
         Control(Desktop* desktop);
 
-        void init(LifeCycle* const fsm, Logger* const logger);
+        void init(Application* const app, LifeCycle* const fsm, Logger* const logger, Pacer* const pacer);
 
         void setSystemInfo(retro_system_info const* info);
 
@@ -36,6 +39,9 @@ namespace hc {
         // hc::Scriptable
         virtual int push(lua_State* const L) override;
 
+        // Time spent in the consoles' onFrame methods, in nanoseconds
+        uint64_t scriptTime() const { return _scriptTime; }
+
     protected:
         void callConsoleMethod(char const* const name);
 
@@ -64,6 +70,9 @@ namespace hc {
         static int l_getRegion(lua_State* const L);
         static int l_getMemoryData(lua_State* const L);
         static int l_getMemorySize(lua_State* const L);
+        static int l_setSpeed(lua_State* const L);
+        static int l_getSpeed(lua_State* const L);
+        static int l_benchmark(lua_State* const L);
 
         struct Console {
             std::string name;
@@ -71,13 +80,16 @@ namespace hc {
             int ref;
         };
 
+        Application* _app;
         LifeCycle* _fsm;
         Logger* _logger;
+        Pacer* _pacer;
 
         std::vector<Console> _consoles;
         int _selected;
         int _opened;
         std::string _extensions;
         std::string _lastGameFolder;
+        uint64_t _scriptTime;
     };
 }
@@ -7,6 +7,7 @@
 #include "Audio.h"
 #include "Input.h"
 #include "Perf.h"
+#include "Trace.h"
 
 #include <imguial_button.h>
 #include <IconsFontAwesome4.h>
@@ -16,12 +17,13 @@
 
 #define TAG "[DSK] "
 
-hc::Desktop::Desktop() : View(nullptr), _logger(nullptr) {}
+hc::Desktop::Desktop() : View(nullptr), _logger(nullptr), _coreMutex(nullptr) {}
 
 void hc::Desktop::init(Logger* const logger) {
     _logger = logger;
     _drawCount = 0;
     _frameCount = 0;
+    _turbo = false;
 }
 
 void hc::Desktop::addView(View* const view, bool const top, bool const free) {
@@ -62,6 +64,14 @@ void hc::Desktop::resetFrameFps() {
     }
 }
 
+void hc::Desktop::setTurbo(bool const turbo) {
+    _turbo = turbo;
+}
+
+void hc::Desktop::setCoreMutex(std::mutex* const mutex) {
+    _coreMutex = mutex;
+}
+
 void hc::Desktop::onStarted() {
     for (auto const& props : _views) {
         View* const view = props->view;
@@ -135,7 +145,13 @@ void hc::Desktop::onFrame() {
 
     for (auto const& props : _views) {
         View* const view = props->view;
+
+        if (_turbo && !view->wantsTurboFrames()) {
+            continue;
+        }
+
         // Don't log stuff per frame
+        Trace::Scope scope(view->getTitle());
         view->onFrame();
     }
 }
@@ -153,6 +169,23 @@ void hc::Desktop::onDraw() {
 
     ImGui::ShowDemoWindow();
 
+    std::unique_lock<std::mutex> lock;
+
+    if (_coreMutex != nullptr) {
+        lock = std::unique_lock<std::mutex>(*_coreMutex);
+    }
+
+    // The set of views can change in the emulation thread, i.e. via Lua
+    _drawList.clear();
+    _closed.clear();
+
+    for (auto const& props : _views) {
+        // Don't recursively draw the plugin manager
+        if (props->view != this && props->opened) {
+            _drawList.emplace_back(props);
+        }
+    }
+
     if (ImGui::Begin(getTitle())) {
         ImGui::Columns(2);
 
@@ -181,21 +214,43 @@ void hc::Desktop::onDraw() {
 
     ImGui::End();
 
-    for (auto const& props : _views) {
+    for (auto const props : _drawList) {
         View* const view = props->view;
         // Don't log stuff per frame
 
-        // Don't recursively draw the plugin manager
-        if (view != this && props->opened) {
-            if (ImGui::Begin(view->getTitle(), &props->opened)) {
-                ImGui::PushID(view);
-                view->onDraw();
-                ImGui::PopID();
-                ImGui::End();
+        // Only hold the core mutex for the views that need it
+        if (lock.mutex() != nullptr && view->drawsCoreState() != lock.owns_lock()) {
+            if (lock.owns_lock()) {
+                lock.unlock();
             }
+            else {
+                lock.lock();
+            }
+        }
+
+        bool opened = true;
+
+        if (ImGui::Begin(view->getTitle(), &opened)) {
+            Trace::Scope scope(view->getTitle());
+            ImGui::PushID(view);
+            view->onDraw();
+            ImGui::PopID();
+            ImGui::End();
+        }
+
+        if (!opened) {
+            _closed.emplace_back(props);
         }
     }
 
+    if (lock.mutex() != nullptr && !lock.owns_lock()) {
+        lock.lock();
+    }
+
+    for (auto const props : _closed) {
+        props->opened = false;
+    }
+
     for (;;) {
         bool done = true;
 
@@ -6,6 +6,8 @@
 
 #include <string.h>
 #include <unordered_set>
+#include <vector>
+#include <mutex>
 
 extern "C" {
     #include <lua.h>
@@ -41,6 +43,14 @@ namespace hc {
         virtual void onCoreUnloaded() {}
         virtual void onQuit() {}
 
+        // Views that return false don't get onFrame calls in turbo mode
+        virtual bool wantsTurboFrames() const { return true; }
+
+        // Views that return false are drawn without the core mutex held, so
+        // their onDraw must only use state that is safe to read from the UI
+        // thread while the core is running
+        virtual bool drawsCoreState() const { return true; }
+
     protected:
         Desktop* _desktop;
     };
@@ -59,6 +69,12 @@ namespace hc {
         double frameFps();
         void resetFrameFps();
 
+        void setTurbo(bool const turbo);
+
+        // onDraw only holds the core mutex while drawing the views that need
+        // it, so a slow UI frame doesn't stall the emulation thread
+        void setCoreMutex(std::mutex* const mutex);
+
         void vprintf(retro_log_level level, char const* format, va_list args);
         void debug(char const* format, ...);
         void info(char const* format, ...);
@@ -92,10 +108,17 @@ namespace hc {
 
         std::unordered_set<ViewProperties*> _views;
 
+        // Used by onDraw, null if the caller holds the core mutex itself
+        std::mutex* _coreMutex;
+        std::vector<ViewProperties*> _drawList;
+        std::vector<ViewProperties*> _closed;
+
         uint64_t _drawCount;
         Timer _drawTimer;
 
         uint64_t _frameCount;
         Timer _frameTimer;
+
+        bool _turbo;
     };
 }
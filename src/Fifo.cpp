@@ -1,72 +1,118 @@
 #include "Fifo.h"
 
+#include <stdlib.h>
 #include <string.h>
 
+hc::Fifo::Fifo() : _head(0), _tail(0), _buffer(nullptr), _mask(0) {}
+
 bool hc::Fifo::init(size_t const size) {
-    _buffer = (uint8_t*)malloc(size);
+    size_t capacity = 1;
+
+    while (capacity < size) {
+        capacity <<= 1;
+    }
+
+    _buffer = (uint8_t*)malloc(capacity);
 
     if (_buffer == NULL) {
         return false;
     }
 
-    _size = _avail = size;
-    _first = _last = 0;
+    _mask = capacity - 1;
+    _head.store(0, std::memory_order_relaxed);
+    _tail.store(0, std::memory_order_relaxed);
     return true;
 }
 
 void hc::Fifo::destroy() {
     ::free(_buffer);
+    _buffer = nullptr;
 }
 
 void hc::Fifo::reset() {
-    _avail = _size;
-    _first = _last = 0;
+    _head.store(0, std::memory_order_relaxed);
+    _tail.store(0, std::memory_order_relaxed);
 }
 
-void hc::Fifo::read(void* const data, size_t const size) {
-    std::lock_guard<std::mutex> lock(_mutex);
+size_t hc::Fifo::read(void* const data, size_t const size) {
+    Region region;
+    size_t const count = reserveRead(size, &region);
 
-    size_t first = size;
-    size_t second = 0;
+    memcpy(data, region.data[0], region.size[0]);
+    memcpy((uint8_t*)data + region.size[0], region.data[1], region.size[1]);
 
-    if (first > _size - _first) {
-        first = _size - _first;
-        second = size - first;
-    }
+    commitRead(count);
+    return count;
+}
+
+size_t hc::Fifo::write(void const* const data, size_t const size) {
+    Region region;
+    size_t const count = reserveWrite(size, &region);
 
-    uint8_t* src = _buffer + _first;
-    memcpy(data, src, first);
-    memcpy((uint8_t*)data + first, _buffer, second);
+    memcpy(region.data[0], data, region.size[0]);
+    memcpy(region.data[1], (uint8_t const*)data + region.size[0], region.size[1]);
 
-    _first = (_first + size) % _size;
-    _avail += size;
+    commitWrite(count);
+    return count;
 }
 
-void hc::Fifo::write(void const* const data, size_t const size) {
-    std::lock_guard<std::mutex> lock(_mutex);
+size_t hc::Fifo::reserveWrite(size_t const size, Region* const region) {
+    size_t const head = _head.load(std::memory_order_relaxed);
+    size_t const tail = _tail.load(std::memory_order_acquire);
+    size_t const avail = _mask + 1 - (head - tail);
+    size_t const count = size <= avail ? size : avail;
 
-    size_t first = size;
-    size_t second = 0;
+    regionAt(head, count, region);
+    return count;
+}
 
-    if (first > _size - _last) {
-        first = _size - _last;
-        second = size - first;
-    }
+void hc::Fifo::commitWrite(size_t const size) {
+    size_t const head = _head.load(std::memory_order_relaxed);
+    _head.store(head + size, std::memory_order_release);
+}
+
+size_t hc::Fifo::reserveRead(size_t const size, Region* const region) {
+    size_t const tail = _tail.load(std::memory_order_relaxed);
+    size_t const head = _head.load(std::memory_order_acquire);
+    size_t const avail = head - tail;
+    size_t const count = size <= avail ? size : avail;
 
-    uint8_t* dest = _buffer + _last;
-    memcpy(dest, data, first);
-    memcpy(_buffer, (uint8_t*)data + first, second);
+    regionAt(tail, count, region);
+    return count;
+}
+
+void hc::Fifo::commitRead(size_t const size) {
+    size_t const tail = _tail.load(std::memory_order_relaxed);
+    _tail.store(tail + size, std::memory_order_release);
+}
 
-    _last = (_last + size) % _size;
-    _avail -= size;
+size_t hc::Fifo::occupied() const {
+    // Loading the tail first never gives a negative count, but threads other
+    // than the producer and the consumer can see the head move more than the
+    // capacity past the tail they loaded
+    size_t const tail = _tail.load(std::memory_order_acquire);
+    size_t const head = _head.load(std::memory_order_acquire);
+    size_t const count = head - tail;
+    return count <= _mask + 1 ? count : _mask + 1;
 }
 
-size_t hc::Fifo::occupied() {
-    std::lock_guard<std::mutex> lock(_mutex);
-    return _size - _avail;
+size_t hc::Fifo::free() const {
+    return _mask + 1 - occupied();
 }
 
-size_t hc::Fifo::free() {
-    std::lock_guard<std::mutex> lock(_mutex);
-    return _avail;
+void hc::Fifo::regionAt(size_t const position, size_t const size, Region* const region) const {
+    size_t const offset = position & _mask;
+    size_t const first = _mask + 1 - offset;
+
+    region->data[0] = _buffer + offset;
+    region->data[1] = _buffer;
+
+    if (size <= first) {
+        region->size[0] = size;
+        region->size[1] = 0;
+    }
+    else {
+        region->size[0] = first;
+        region->size[1] = size - first;
+    }
 }
@@ -1,29 +1,61 @@
 #pragma once
 
 #include <stddef.h>
-#include <mutex>
+#include <stdint.h>
+#include <atomic>
 
 namespace hc {
+    // Single-producer, single-consumer lock-free byte ring buffer. Only one
+    // thread may write and only one thread may read at any given time.
     class Fifo final {
     public:
+        // Up to two contiguous parts of the ring, the second one starting at
+        // the beginning of the buffer when the first one reaches its end
+        struct Region {
+            uint8_t* data[2];
+            size_t size[2];
+        };
+
+        Fifo();
+
+        // The size is rounded up to the next power of two
         bool init(size_t const size);
         void destroy();
+
+        // Must only be called when neither the producer nor the consumer are
+        // using the ring
         void reset();
 
-        void read(void* const data, size_t const size);
-        void write(void const* const data, size_t const size);
+        // Return the number of bytes actually transferred
+        size_t read(void* const data, size_t const size);
+        size_t write(void const* const data, size_t const size);
+
+        // Reserve up to size bytes for writing or reading, and return the
+        // number of bytes reserved; the data is only made available to the
+        // other side after the commit
+        size_t reserveWrite(size_t const size, Region* const region);
+        void commitWrite(size_t const size);
+        size_t reserveRead(size_t const size, Region* const region);
+        void commitRead(size_t const size);
 
-        size_t size() { return _size; }
+        size_t size() const { return _mask + 1; }
 
-        size_t occupied();
-        size_t free();
+        size_t occupied() const;
+        size_t free() const;
 
     protected:
-        std::mutex _mutex;
-        uint8_t* _buffer;
-        size_t _size;
-        size_t _avail;
-        size_t _first;
-        size_t _last;
+        enum {
+            CacheLineSize = 64
+        };
+
+        void regionAt(size_t const position, size_t const size, Region* const region) const;
+
+        // Written only by the producer
+        alignas(CacheLineSize) std::atomic<size_t> _head;
+        // Written only by the consumer
+        alignas(CacheLineSize) std::atomic<size_t> _tail;
+
+        alignas(CacheLineSize) uint8_t* _buffer;
+        size_t _mask;
     };
 }
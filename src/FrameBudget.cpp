@@ -0,0 +1,247 @@
+#include "FrameBudget.h"
+#include "Perf.h"
+
+#include <IconsFontAwesome4.h>
+#include <imgui.h>
+
+#include <inttypes.h>
+#include <string.h>
+
+#define TAG "[FBG] "
+
+namespace {
+    struct PhaseInfo {
+        char const* name;
+        ImU32 color;
+    };
+
+    // In the order of hc::FrameBudget::Phase, plus idle
+    PhaseInfo const phaseInfo[] = {
+        {"Emulation", IM_COL32(66, 133, 244, 255)},
+        {"Video copy", IM_COL32(52, 168, 83, 255)},
+        {"Audio flush", IM_COL32(251, 188, 5, 255)},
+        {"Lua onFrame", IM_COL32(171, 71, 188, 255)},
+        {"Views onFrame", IM_COL32(0, 172, 193, 255)},
+        {"ImGui build", IM_COL32(255, 112, 67, 255)},
+        {"Video upload", IM_COL32(124, 179, 66, 255)},
+        {"GL render", IM_COL32(141, 110, 99, 255)},
+        {"Swap", IM_COL32(120, 144, 156, 255)},
+        {"Idle", IM_COL32(60, 60, 60, 255)}
+    };
+
+    ImU32 const overBudgetColor = IM_COL32(160, 32, 32, 96);
+    ImU32 const budgetLineColor = IM_COL32(255, 64, 64, 255);
+}
+
+hc::FrameBudget::FrameBudget(Desktop* desktop)
+    : View(desktop)
+    , _budget(0)
+    , _start(0)
+    , _head(0)
+    , _count(0)
+    , _paused(false)
+{
+    for (unsigned i = 0; i < PhaseCount; i++) {
+        _current[i] = 0;
+    }
+}
+
+void hc::FrameBudget::init() {
+    reset();
+}
+
+void hc::FrameBudget::setBudget(uint64_t const usPerFrame) {
+    _budget = usPerFrame * 1000;
+}
+
+void hc::FrameBudget::add(Phase const phase, uint64_t const ns) {
+    _current[static_cast<unsigned>(phase)].fetch_add(ns, std::memory_order_relaxed);
+}
+
+void hc::FrameBudget::frame() {
+    uint64_t const now = Perf::getTimeNs();
+
+    if (_start == 0 || _paused) {
+        // Drop what was added before the first frame or while paused
+        for (unsigned i = 0; i < PhaseCount; i++) {
+            _current[i].store(0, std::memory_order_relaxed);
+        }
+    }
+    else {
+        Frame& frame = _frames[_head];
+
+        for (unsigned i = 0; i < PhaseCount; i++) {
+            frame.phases[i] = _current[i].exchange(0, std::memory_order_relaxed);
+        }
+
+        frame.period = now - _start;
+
+        _head = (_head + 1) % FrameCount;
+        _count += _count < FrameCount;
+    }
+
+    _start = now;
+}
+
+char const* hc::FrameBudget::getTitle() {
+    return ICON_FA_AREA_CHART " Frame Budget";
+}
+
+void hc::FrameBudget::onGameStarted() {
+    reset();
+}
+
+void hc::FrameBudget::onGameResumed() {
+    // Don't count the time spent paused
+    _start = 0;
+}
+
+void hc::FrameBudget::onDraw() {
+    ImGui::Checkbox("Pause", &_paused);
+    ImGui::SameLine();
+
+    if (ImGui::Button(ICON_FA_TRASH_O " Clear")) {
+        reset();
+    }
+
+    ImGui::SameLine();
+    ImGui::Text("Budget %.3f ms", _budget / 1000000.0);
+
+    drawBars(120.0f);
+    drawLegend();
+}
+
+void hc::FrameBudget::onGameUnloaded() {
+    reset();
+}
+
+void hc::FrameBudget::reset() {
+    for (unsigned i = 0; i < PhaseCount; i++) {
+        _current[i].store(0, std::memory_order_relaxed);
+    }
+
+    _start = 0;
+    _head = 0;
+    _count = 0;
+}
+
+bool hc::FrameBudget::serial(unsigned const phase) {
+    // Phases that can't overlap with the core because they run in the
+    // emulation thread
+    return phase <= static_cast<unsigned>(Phase::Views);
+}
+
+uint64_t hc::FrameBudget::busy(Frame const& frame) {
+    uint64_t total = 0;
+
+    for (unsigned i = 0; i < PhaseCount; i++) {
+        total += serial(i) ? frame.phases[i] : 0;
+    }
+
+    return total;
+}
+
+void hc::FrameBudget::drawBars(float const height) {
+    ImVec2 const pos = ImGui::GetCursorScreenPos();
+    ImVec2 const size = ImVec2(ImGui::GetContentRegionAvail().x, height);
+    ImDrawList* const drawList = ImGui::GetWindowDrawList();
+
+    drawList->AddRectFilled(pos, ImVec2(pos.x + size.x, pos.y + size.y), ImGui::GetColorU32(ImGuiCol_FrameBg));
+
+    // The budget sits at the middle, taller bars are clipped
+    double const scale = _budget != 0 ? size.y / (_budget * 2.0) : 0.0;
+    float const barWidth = size.x / FrameCount;
+    float const bottom = pos.y + size.y;
+
+    for (unsigned i = 0; i < _count; i++) {
+        Frame const& frame = _frames[(_head + FrameCount - _count + i) % FrameCount];
+        float const left = pos.x + (FrameCount - _count + i) * barWidth;
+        float const right = left + (barWidth > 2.0f ? barWidth - 1.0f : barWidth);
+
+        if (busy(frame) > _budget) {
+            drawList->AddRectFilled(ImVec2(left, pos.y), ImVec2(right, bottom), overBudgetColor);
+        }
+
+        uint64_t stacked = 0;
+
+        for (unsigned j = 0; j <= PhaseCount; j++) {
+            uint64_t const value = j < PhaseCount ? frame.phases[j] : (frame.period > stacked ? frame.period - stacked : 0);
+
+            float const y0 = bottom - static_cast<float>(stacked * scale);
+            stacked += value;
+            float const y1 = bottom - static_cast<float>(stacked * scale);
+
+            if (y0 <= pos.y) {
+                break;
+            }
+
+            drawList->AddRectFilled(ImVec2(left, y1 > pos.y ? y1 : pos.y), ImVec2(right, y0), phaseInfo[j].color);
+        }
+    }
+
+    float const budgetY = pos.y + size.y / 2.0f;
+    drawList->AddLine(ImVec2(pos.x, budgetY), ImVec2(pos.x + size.x, budgetY), budgetLineColor);
+
+    ImGui::InvisibleButton("##bars", size);
+
+    if (!ImGui::IsItemHovered() || _count == 0) {
+        return;
+    }
+
+    int const slot = static_cast<int>((ImGui::GetMousePos().x - pos.x) / barWidth) - (FrameCount - _count);
+
+    if (slot < 0 || slot >= static_cast<int>(_count)) {
+        return;
+    }
+
+    Frame const& frame = _frames[(_head + FrameCount - _count + slot) % FrameCount];
+
+    ImGui::BeginTooltip();
+    ImGui::Text("Frame %d of %u, %.3f ms busy, %.3f ms period", slot + 1, _count, busy(frame) / 1000000.0, frame.period / 1000000.0);
+
+    for (unsigned i = 0; i < PhaseCount; i++) {
+        ImGui::Text("%8.3f ms %s%s", frame.phases[i] / 1000000.0, phaseInfo[i].name, serial(i) ? "" : " *");
+    }
+
+    ImGui::EndTooltip();
+}
+
+void hc::FrameBudget::drawLegend() {
+    uint64_t total[PhaseCount + 1];
+    uint64_t peak[PhaseCount + 1];
+    unsigned over = 0;
+
+    memset(total, 0, sizeof(total));
+    memset(peak, 0, sizeof(peak));
+
+    for (unsigned i = 0; i < _count; i++) {
+        Frame const& frame = _frames[i];
+        uint64_t stacked = 0;
+
+        for (unsigned j = 0; j <= PhaseCount; j++) {
+            uint64_t const value = j < PhaseCount ? frame.phases[j] : (frame.period > stacked ? frame.period - stacked : 0);
+            stacked += value;
+            total[j] += value;
+            peak[j] = value > peak[j] ? value : peak[j];
+        }
+
+        over += busy(frame) > _budget;
+    }
+
+    ImGui::Text("%u of %u frames over budget, phases marked with * run in parallel with the core", over, _count);
+    ImGui::Text("    average      max (ms)");
+
+    ImDrawList* const drawList = ImGui::GetWindowDrawList();
+    float const side = ImGui::GetTextLineHeight();
+
+    for (unsigned i = 0; i <= PhaseCount; i++) {
+        ImVec2 const pos = ImGui::GetCursorScreenPos();
+        drawList->AddRectFilled(pos, ImVec2(pos.x + side, pos.y + side), phaseInfo[i].color);
+        ImGui::Dummy(ImVec2(side, side));
+        ImGui::SameLine();
+
+        double const average = _count != 0 ? total[i] / 1000000.0 / _count : 0.0;
+        bool const parallel = i < PhaseCount && !serial(i);
+        ImGui::Text("%8.3f %8.3f  %s%s", average, peak[i] / 1000000.0, phaseInfo[i].name, parallel ? " *" : "");
+    }
+}
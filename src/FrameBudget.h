@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Desktop.h"
+
+#include <stdint.h>
+#include <atomic>
+
+namespace hc {
+    // Breaks the time of each emulated frame down into the subsystems that
+    // used it, and shows the last frames as stacked bars. Phases can be
+    // added from any thread, and are assigned to the frame that is running
+    // in the emulation thread when they are added.
+    class FrameBudget : public View {
+    public:
+        enum class Phase {
+            // Emulation thread, with the core mutex held
+            Emulation,
+            Video,
+            Audio,
+            Scripts,
+            Views,
+
+            // UI thread, Draw only holds the core mutex for the views that
+            // draw core state
+            Draw,
+            Upload,
+            Render,
+            Swap,
+
+            Count
+        };
+
+        enum {
+            FrameCount = 300
+        };
+
+        FrameBudget(Desktop* desktop);
+        virtual ~FrameBudget() {}
+
+        void init();
+
+        // The time available to each frame, in microseconds
+        void setBudget(uint64_t const usPerFrame);
+
+        // Thread-safe
+        void add(Phase const phase, uint64_t const ns);
+
+        // Closes the current frame, must be called by the emulation thread
+        // before running each frame
+        void frame();
+
+        // hc::View
+        virtual char const* getTitle() override;
+        virtual void onGameStarted() override;
+        virtual void onGameResumed() override;
+        virtual void onDraw() override;
+        virtual void onGameUnloaded() override;
+
+    protected:
+        enum {
+            PhaseCount = static_cast<int>(Phase::Count)
+        };
+
+        struct Frame {
+            uint64_t phases[PhaseCount];
+            uint64_t period;
+        };
+
+        void reset();
+        static bool serial(unsigned const phase);
+        static uint64_t busy(Frame const& frame);
+        void drawBars(float const height);
+        void drawLegend();
+
+        uint64_t _budget;
+        uint64_t _start;
+
+        std::atomic<uint64_t> _current[PhaseCount];
+
+        // Written by the emulation thread and read by the UI thread, both
+        // with the core mutex held
+        Frame _frames[FrameCount];
+        unsigned _head;
+        unsigned _count;
+        bool _paused;
+    };
+}
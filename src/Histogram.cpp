@@ -0,0 +1,78 @@
+#include "Histogram.h"
+
+#include <string.h>
+
+static unsigned highestBit(uint64_t value) {
+#ifdef __GNUC__
+    return 63 - __builtin_clzll(value);
+#else
+    unsigned bit = 0;
+
+    while (value >>= 1) {
+        bit++;
+    }
+
+    return bit;
+#endif
+}
+
+hc::Histogram::Histogram() {
+    reset();
+}
+
+void hc::Histogram::add(uint64_t const value) {
+    _buckets[bucketOf(value)]++;
+    _count++;
+    _sum += value;
+    _min = value < _min ? value : _min;
+    _max = value > _max ? value : _max;
+}
+
+void hc::Histogram::reset() {
+    memset(_buckets, 0, sizeof(_buckets));
+    _count = _sum = _max = 0;
+    _min = UINT64_MAX;
+}
+
+uint64_t hc::Histogram::percentile(double const p) const {
+    if (_count == 0) {
+        return 0;
+    }
+
+    // Nearest rank
+    uint64_t rank = static_cast<uint64_t>(p / 100.0 * _count + 0.5);
+    rank = rank < 1 ? 1 : rank > _count ? _count : rank;
+
+    uint64_t seen = 0;
+
+    for (unsigned i = 0; i < Buckets; i++) {
+        seen += _buckets[i];
+
+        if (seen >= rank) {
+            uint64_t const highest = highestOf(i);
+            return highest < _max ? highest : _max;
+        }
+    }
+
+    return _max;
+}
+
+unsigned hc::Histogram::bucketOf(uint64_t const value) {
+    if (value < SubBuckets) {
+        return static_cast<unsigned>(value);
+    }
+
+    // The top SubBits + 1 bits select the sub-bucket
+    unsigned const shift = highestBit(value) - SubBits;
+    return (shift + 1) * SubBuckets + static_cast<unsigned>((value >> shift) - SubBuckets);
+}
+
+uint64_t hc::Histogram::highestOf(unsigned const bucket) {
+    if (bucket < SubBuckets) {
+        return bucket;
+    }
+
+    unsigned const shift = bucket / SubBuckets - 1;
+    uint64_t const lowest = static_cast<uint64_t>(SubBuckets + bucket % SubBuckets) << shift;
+    return lowest + ((static_cast<uint64_t>(1) << shift) - 1);
+}
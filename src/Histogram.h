@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace hc {
+    // A histogram with logarithmic buckets in the spirit of HdrHistogram.
+    // Each power of two is split into 16 sub-buckets, so percentiles are
+    // within about 6% of the real value across the whole 64-bit range, at a
+    // constant cost per sample.
+    class Histogram final {
+    public:
+        Histogram();
+
+        void add(uint64_t const value);
+        void reset();
+
+        uint64_t count() const { return _count; }
+        uint64_t min() const { return _count != 0 ? _min : 0; }
+        uint64_t max() const { return _max; }
+        double mean() const { return _count != 0 ? static_cast<double>(_sum) / _count : 0.0; }
+
+        // p in [0, 100], the result is the highest value in the bucket of the
+        // sample at that rank, clamped to the maximum value seen
+        uint64_t percentile(double const p) const;
+
+    protected:
+        enum {
+            SubBits = 4,
+            SubBuckets = 1 << SubBits,
+            Buckets = (64 - SubBits + 1) * SubBuckets
+        };
+
+        static unsigned bucketOf(uint64_t const value);
+        static uint64_t highestOf(unsigned const bucket);
+
+        uint64_t _buckets[Buckets];
+        uint64_t _count;
+        uint64_t _sum;
+        uint64_t _min;
+        uint64_t _max;
+    };
+}
@@ -13,12 +13,199 @@ extern "C" {
 #define KEYBOARD_ID -2
 #define TAG "[INP] "
 
-hc::Input::Input(Desktop* desktop) : View(desktop), _frontend(nullptr), _keyboardState{false} {}
+static void put16(uint8_t* const p, uint16_t const value) {
+    p[0] = value & 0xff;
+    p[1] = value >> 8;
+}
+
+static void put32(uint8_t* const p, uint32_t const value) {
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+static uint16_t get16(uint8_t const* const p) {
+    return static_cast<uint16_t>(p[0] | p[1] << 8);
+}
+
+static uint32_t get32(uint8_t const* const p) {
+    return static_cast<uint32_t>(p[0])
+         | static_cast<uint32_t>(p[1]) << 8
+         | static_cast<uint32_t>(p[2]) << 16
+         | static_cast<uint32_t>(p[3]) << 24;
+}
+
+static void putBits(uint8_t* const p, bool const* const bits, size_t const count) {
+    memset(p, 0, (count + 7) / 8);
+
+    for (size_t i = 0; i < count; i++) {
+        p[i / 8] |= bits[i] << (i % 8);
+    }
+}
+
+static void getBits(uint8_t const* const p, bool* const bits, size_t const count) {
+    for (size_t i = 0; i < count; i++) {
+        bits[i] = (p[i / 8] >> (i % 8)) & 1;
+    }
+}
+
+hc::Input::Input(Desktop* desktop)
+    : View(desktop)
+    , _frontend(nullptr)
+    , _current(&_snapshots.readBuffer())
+    , _keyboardState{false}
+{}
 
 void hc::Input::init(lrcpp::Frontend* const frontend) {
     _frontend = frontend;
 }
 
+void hc::Input::snapshot() {
+    Snapshot& snapshot = _snapshots.writeBuffer();
+    memset(&snapshot, 0, sizeof(snapshot));
+
+    for (size_t port = 0; port < MaxPorts; port++) {
+        Controller const* const controller = _ports[port].controller;
+
+        if (controller == nullptr) {
+            continue;
+        }
+
+        for (unsigned id = 0; id < 16; id++) {
+            snapshot.buttons[port][id] = controller->getButton(id);
+        }
+
+        for (unsigned index = 0; index < 3; index++) {
+            snapshot.analogs[port][index][0] = controller->getAnalog(index, RETRO_DEVICE_ID_ANALOG_X);
+            snapshot.analogs[port][index][1] = controller->getAnalog(index, RETRO_DEVICE_ID_ANALOG_Y);
+        }
+    }
+
+    if (_keyboard != nullptr) {
+        bool const* const state = _keyboard->getState();
+
+        for (unsigned i = RETROK_FIRST; i < RETROK_LAST; i++) {
+            snapshot.keys[i] = _keyboard->getKey(i);
+            snapshot.rawKeys[i] = state[i];
+        }
+    }
+
+    if (_mouse != nullptr) {
+        snapshot.mouseInside = _mouse->getPosition(&snapshot.mouseX, &snapshot.mouseY);
+        snapshot.mouseLeft = _mouse->getLeftDown();
+        snapshot.mouseRight = _mouse->getRightDown();
+    }
+
+    _snapshots.publish();
+}
+
+void hc::Input::latch() {
+    // Keep using the previous snapshot if there isn't a new one
+    _snapshots.acquire();
+    _current = &_snapshots.readBuffer();
+
+    uint8_t packed[PackedSize];
+
+    if (_movie.replaying()) {
+        if (_movie.next(packed)) {
+            unpack(packed, &_replayed);
+            _current = &_replayed;
+        }
+        else {
+            _desktop->info(TAG "Movie \"%s\" ended after %u frames", _movie.path(), _movie.position());
+            stopMovie();
+        }
+    }
+    else if (_movie.recording()) {
+        pack(*_current, packed);
+        _movie.add(packed);
+    }
+}
+
+bool hc::Input::recordMovie(char const* const path, bool const anchored) {
+    stopMovie();
+
+    std::vector<uint8_t> state;
+
+    if (anchored) {
+        size_t size = 0;
+
+        if (!_frontend->serializeSize(&size)) {
+            _desktop->error(TAG "Error getting the savestate size");
+            return false;
+        }
+
+        state.resize(size);
+
+        if (!_frontend->serialize(state.data(), size)) {
+            _desktop->error(TAG "Error serializing the anchor state");
+            return false;
+        }
+    }
+
+    // Mouse deltas and keyboard events depend on the state before the movie
+    uint8_t anchor[AnchorSize];
+    put32(anchor, static_cast<uint32_t>(_lastX));
+    put32(anchor + 4, static_cast<uint32_t>(_lastY));
+    putBits(anchor + 8, _keyboardState, RETROK_LAST);
+
+    _movie.record(path, PackedSize, anchor, AnchorSize, state.data(), state.size());
+    _desktop->info(TAG "Recording movie to \"%s\"", path);
+    return true;
+}
+
+bool hc::Input::replayMovie(char const* const path) {
+    stopMovie();
+
+    std::string error;
+
+    if (!_movie.load(path, PackedSize, &error)) {
+        _desktop->error(TAG "Error loading movie \"%s\": %s", path, error.c_str());
+        return false;
+    }
+
+    std::vector<uint8_t> const& state = _movie.state();
+
+    if (!state.empty() && !_frontend->unserialize(state.data(), state.size())) {
+        _desktop->error(TAG "Error restoring the movie anchor state");
+        _movie.stop(&error);
+        return false;
+    }
+
+    std::vector<uint8_t> const& anchor = _movie.anchor();
+
+    if (anchor.size() == AnchorSize) {
+        _lastX = static_cast<int32_t>(get32(anchor.data()));
+        _lastY = static_cast<int32_t>(get32(anchor.data() + 4));
+        getBits(anchor.data() + 8, _keyboardState, RETROK_LAST);
+    }
+
+    _desktop->info(TAG "Replaying movie \"%s\" with %u frames", path, _movie.frames());
+    return true;
+}
+
+void hc::Input::stopMovie() {
+    bool const recording = _movie.recording();
+    std::string error;
+
+    if (!_movie.stop(&error)) {
+        _desktop->error(TAG "Error saving movie \"%s\": %s", _movie.path(), error.c_str());
+    }
+    else if (recording) {
+        _desktop->info(
+            TAG "Saved movie \"%s\", %u frames in %zu bytes",
+            _movie.path(), _movie.frames(), _movie.streamSize()
+        );
+    }
+
+    _current = &_snapshots.readBuffer();
+}
+
+hc::Input* hc::Input::check(lua_State* const L, int const index) {
+    return *static_cast<Input**>(luaL_checkudata(L, index, "hc::Input"));
+}
+
 char const* hc::Input::getTitle() {
     return ICON_FA_GAMEPAD " Input";
 }
@@ -45,6 +232,21 @@ void hc::Input::onCoreLoaded() {
 void hc::Input::onDraw() {
     static char const* const portNames[MaxPorts] = {"Port 1", "Port 2", "Port 3", "Port 4"};
 
+    if (_movie.recording() || _movie.replaying()) {
+        if (_movie.recording()) {
+            ImGui::Text(ICON_FA_CIRCLE " Recording, %u frames, %zu bytes", _movie.frames(), _movie.streamSize());
+        }
+        else {
+            ImGui::Text(ICON_FA_PLAY " Replaying, frame %u of %u", _movie.position(), _movie.frames());
+        }
+
+        ImGui::SameLine();
+
+        if (ImGui::Button(ICON_FA_STOP " Stop")) {
+            stopMovie();
+        }
+    }
+
     if (ImGui::BeginTabBar("##ports")) {
         for (size_t port = 0; port < MaxPorts; port++) {
             if (ImGui::BeginTabItem(portNames[port])) {
@@ -92,6 +294,10 @@ void hc::Input::onDraw() {
     }
 }
 
+void hc::Input::onGameUnloaded() {
+    stopMovie();
+}
+
 void hc::Input::onCoreUnloaded() {
     for (size_t port = 0; port < MaxPorts; port++) {
         // Disconnect all ports
@@ -233,36 +439,31 @@ int16_t hc::Input::state(unsigned portIndex, unsigned deviceId, unsigned index,
     }
 
     unsigned const base = deviceId & RETRO_DEVICE_MASK;
-    Port const& port = _ports[portIndex];
+    Snapshot const& snapshot = *_current;
 
     switch (base) {
         case RETRO_DEVICE_JOYPAD: {
-            return port.controller != nullptr ? (port.controller->getButton(id) ? 32767 : 0) : 0;
+            return id < 16 && snapshot.buttons[portIndex][id] ? 32767 : 0;
         }
 
         case RETRO_DEVICE_ANALOG: {
-            return port.controller != nullptr ? port.controller->getAnalog(index, id) : 0;
+            return index < 3 && id < 2 ? snapshot.analogs[portIndex][index][id] : 0;
         }
 
         case RETRO_DEVICE_KEYBOARD: {
-            return _keyboard != nullptr ? (_keyboard->getKey(id) ? 32767 : 0) : 0;
+            return id < RETROK_LAST && snapshot.keys[id] ? 32767 : 0;
         }
 
         case RETRO_DEVICE_MOUSE: {
-            if (_mouse == nullptr) {
-                return 0;
-            }
-
-            int x = 0, y = 0;
-            bool const inside = _mouse->getPosition(&x, &y);
+            bool const inside = snapshot.mouseInside;
 
             switch (id) {
                 case RETRO_DEVICE_ID_MOUSE_X: {
                     int dx = 0;
 
                     if (inside) {
-                        dx = x - _lastX;
-                        _lastX = x;
+                        dx = snapshot.mouseX - _lastX;
+                        _lastX = snapshot.mouseX;
                     }
 
                     return dx;
@@ -272,15 +473,15 @@ int16_t hc::Input::state(unsigned portIndex, unsigned deviceId, unsigned index,
                     int dy = 0;
 
                     if (inside) {
-                        dy = y - _lastY;
-                        _lastY = y;
+                        dy = snapshot.mouseY - _lastY;
+                        _lastY = snapshot.mouseY;
                     }
 
                     return dy;
                 }
 
-                case RETRO_DEVICE_ID_MOUSE_LEFT: return inside ? (_mouse->getLeftDown() ? 32767 : 0) : 0;
-                case RETRO_DEVICE_ID_MOUSE_RIGHT: return inside ? (_mouse->getRightDown() ? 32767 : 0) : 0;
+                case RETRO_DEVICE_ID_MOUSE_LEFT: return inside ? (snapshot.mouseLeft ? 32767 : 0) : 0;
+                case RETRO_DEVICE_ID_MOUSE_RIGHT: return inside ? (snapshot.mouseRight ? 32767 : 0) : 0;
             }
 
             break;
@@ -291,8 +492,8 @@ int16_t hc::Input::state(unsigned portIndex, unsigned deviceId, unsigned index,
 }
 
 void hc::Input::poll() {
-    if (_keyboardCallback.callback != nullptr && _keyboard != nullptr) {
-        bool const* const state = _keyboard->getState();
+    if (_keyboardCallback.callback != nullptr) {
+        bool const* const state = _current->rawKeys;
 
         for (unsigned i = RETROK_FIRST; i < RETROK_LAST; i++) {
             if (state[i] != _keyboardState[i]) {
@@ -302,3 +503,118 @@ void hc::Input::poll() {
         }
     }
 }
+
+int hc::Input::push(lua_State* const L) {
+    auto const self = static_cast<Input**>(lua_newuserdata(L, sizeof(Input*)));
+    *self = this;
+
+    if (luaL_newmetatable(L, "hc::Input")) {
+        static luaL_Reg const methods[] = {
+            {"recordMovie", l_recordMovie},
+            {"replayMovie", l_replayMovie},
+            {"stopMovie", l_stopMovie},
+            {"movieStatus", l_movieStatus},
+            {nullptr, nullptr}
+        };
+
+        luaL_newlib(L, methods);
+        lua_setfield(L, -2, "__index");
+    }
+
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+void hc::Input::pack(Snapshot const& snapshot, uint8_t* packed) {
+    for (unsigned port = 0; port < MaxPorts; port++, packed += 2) {
+        uint16_t bits = 0;
+
+        for (unsigned id = 0; id < 16; id++) {
+            bits |= snapshot.buttons[port][id] << id;
+        }
+
+        put16(packed, bits);
+    }
+
+    for (unsigned port = 0; port < MaxPorts; port++) {
+        for (unsigned index = 0; index < 3; index++, packed += 4) {
+            put16(packed, static_cast<uint16_t>(snapshot.analogs[port][index][0]));
+            put16(packed + 2, static_cast<uint16_t>(snapshot.analogs[port][index][1]));
+        }
+    }
+
+    putBits(packed, snapshot.keys, RETROK_LAST);
+    putBits(packed + KeyBytes, snapshot.rawKeys, RETROK_LAST);
+    packed += KeyBytes * 2;
+
+    put32(packed, static_cast<uint32_t>(snapshot.mouseX));
+    put32(packed + 4, static_cast<uint32_t>(snapshot.mouseY));
+    packed[8] = snapshot.mouseInside | snapshot.mouseLeft << 1 | snapshot.mouseRight << 2;
+}
+
+void hc::Input::unpack(uint8_t const* packed, Snapshot* const snapshot) {
+    for (unsigned port = 0; port < MaxPorts; port++, packed += 2) {
+        uint16_t const bits = get16(packed);
+
+        for (unsigned id = 0; id < 16; id++) {
+            snapshot->buttons[port][id] = (bits >> id) & 1;
+        }
+    }
+
+    for (unsigned port = 0; port < MaxPorts; port++) {
+        for (unsigned index = 0; index < 3; index++, packed += 4) {
+            snapshot->analogs[port][index][0] = static_cast<int16_t>(get16(packed));
+            snapshot->analogs[port][index][1] = static_cast<int16_t>(get16(packed + 2));
+        }
+    }
+
+    getBits(packed, snapshot->keys, RETROK_LAST);
+    getBits(packed + KeyBytes, snapshot->rawKeys, RETROK_LAST);
+    packed += KeyBytes * 2;
+
+    snapshot->mouseX = static_cast<int32_t>(get32(packed));
+    snapshot->mouseY = static_cast<int32_t>(get32(packed + 4));
+    snapshot->mouseInside = (packed[8] & 1) != 0;
+    snapshot->mouseLeft = (packed[8] & 2) != 0;
+    snapshot->mouseRight = (packed[8] & 4) != 0;
+}
+
+int hc::Input::l_recordMovie(lua_State* const L) {
+    auto const self = check(L, 1);
+    char const* const path = luaL_checkstring(L, 2);
+    bool const anchored = lua_isnone(L, 3) || lua_toboolean(L, 3);
+
+    if (!self->recordMovie(path, anchored)) {
+        return luaL_error(L, "could not record movie \"%s\"", path);
+    }
+
+    return 0;
+}
+
+int hc::Input::l_replayMovie(lua_State* const L) {
+    auto const self = check(L, 1);
+    char const* const path = luaL_checkstring(L, 2);
+
+    if (!self->replayMovie(path)) {
+        return luaL_error(L, "could not replay movie \"%s\"", path);
+    }
+
+    return 0;
+}
+
+int hc::Input::l_stopMovie(lua_State* const L) {
+    auto const self = check(L, 1);
+    self->stopMovie();
+    return 0;
+}
+
+int hc::Input::l_movieStatus(lua_State* const L) {
+    auto const self = check(L, 1);
+    Movie const& movie = self->_movie;
+
+    char const* const mode = movie.recording() ? "recording" : movie.replaying() ? "replaying" : "idle";
+    lua_pushstring(L, mode);
+    lua_pushinteger(L, movie.recording() ? movie.frames() : movie.position());
+    lua_pushinteger(L, movie.frames());
+    return 3;
+}
@@ -1,7 +1,10 @@
 #pragma once
 
 #include "Desktop.h"
+#include "Scriptable.h"
 #include "Devices.h"
+#include "Mailbox.h"
+#include "Movie.h"
 
 #include <lrcpp/Components.h>
 #include <lrcpp/Frontend.h>
@@ -14,19 +17,39 @@
 #include <vector>
 
 namespace hc {
-    class Input: public View, public DeviceListener, public lrcpp::Input {
+    class Input: public View, public Scriptable, public DeviceListener, public lrcpp::Input {
     public:
         Input(Desktop* desktop);
         virtual ~Input() {}
 
         void init(lrcpp::Frontend* const frontend);
 
+        // Called from the UI thread after processing events to publish the
+        // current state of the devices
+        void snapshot();
+
+        // Called from the emulation thread before running a frame to get the
+        // latest snapshot published by the UI thread, or the next one from
+        // the movie being replayed
+        void latch();
+
+        // Movies must be started and stopped with the core mutex held
+        bool recordMovie(char const* const path, bool const anchored);
+        bool replayMovie(char const* const path);
+        void stopMovie();
+
+        static Input* check(lua_State* const L, int const index);
+
         // hc::View
         virtual char const* getTitle() override;
         virtual void onCoreLoaded() override;
         virtual void onDraw() override;
+        virtual void onGameUnloaded() override;
         virtual void onCoreUnloaded() override;
 
+        // hc::Scriptable
+        virtual int push(lua_State* const L) override;
+
         // hc::DeviceListener
         virtual void deviceInserted(Device* device) override;
         virtual void deviceRemoved(Device* device) override;
@@ -43,7 +66,11 @@ namespace hc {
 
     protected:
         enum {
-            MaxPorts = 4
+            MaxPorts = 4,
+            // Snapshots are packed into this many bytes in movies
+            KeyBytes = (RETROK_LAST + 7) / 8,
+            PackedSize = MaxPorts * 2 + MaxPorts * 3 * 2 * 2 + KeyBytes * 2 + 4 * 2 + 1,
+            AnchorSize = 4 * 2 + KeyBytes
         };
 
         struct ControllerInfo {
@@ -52,6 +79,25 @@ namespace hc {
             unsigned id;
         };
 
+        // State of all devices connected to the ports, as seen by the core
+        struct Snapshot {
+            bool buttons[MaxPorts][16];
+            int16_t analogs[MaxPorts][3][2];
+            bool keys[RETROK_LAST];
+            bool rawKeys[RETROK_LAST];
+            int mouseX, mouseY;
+            bool mouseInside;
+            bool mouseLeft, mouseRight;
+        };
+
+        static void pack(Snapshot const& snapshot, uint8_t* const packed);
+        static void unpack(uint8_t const* const packed, Snapshot* const snapshot);
+
+        static int l_recordMovie(lua_State* const L);
+        static int l_replayMovie(lua_State* const L);
+        static int l_stopMovie(lua_State* const L);
+        static int l_movieStatus(lua_State* const L);
+
         struct Port {
             int selectedType; // for the UI
             int selectedDevice; // for the UI
@@ -79,6 +125,13 @@ namespace hc {
         // The device attached to each port
         Port _ports[MaxPorts];
 
+        Mailbox<Snapshot> _snapshots;
+
+        // The snapshot seen by the core in the current frame
+        Snapshot const* _current;
+        Snapshot _replayed;
+        Movie _movie;
+
         // Last mouse positions to calculate the deltas
         int _lastX;
         int _lastY;
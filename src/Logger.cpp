@@ -44,6 +44,7 @@ void hc::Logger::onDraw() {
     switch (button) {
         case 1: {
             std::string buffer;
+            std::lock_guard<std::mutex> lock(_mutex);
 
             _logger.iterate([&buffer](ImGuiAl::Log::Info const& header, char const* const line) -> bool {
                 switch (static_cast<ImGuiAl::Log::Level>(header.metaData)) {
@@ -64,6 +65,7 @@ void hc::Logger::onDraw() {
         }
 
         case 2: {
+            std::lock_guard<std::mutex> lock(_mutex);
             _logger.clear();
             break;
         }
@@ -71,6 +73,8 @@ void hc::Logger::onDraw() {
 }
 
 void hc::Logger::onCoreUnloaded() {
+    // The view is drawn without the core mutex
+    std::lock_guard<std::mutex> lock(_mutex);
     _logger.clear();
 }
 
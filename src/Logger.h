@@ -25,6 +25,7 @@ namespace hc {
         // hc::View
         virtual char const* getTitle() override;
         virtual void onDraw() override;
+        virtual bool drawsCoreState() const override { return false; }
         virtual void onCoreUnloaded() override;
 
         // hc::Scriptable
@@ -1,4 +1,5 @@
 #include "LuaUtil.h"
+#include "Trace.h"
 
 extern "C" {
     #include "lauxlib.h"
@@ -174,5 +175,7 @@ bool hc::protectedCallField(
     }
 
     lua_insert(L, lua_gettop(L) - nargs);
+
+    Trace::Scope scope(fieldName);
     return protectedCall(L, nargs, nresults, logger);
 }
@@ -0,0 +1,200 @@
+#include "Lz.h"
+
+#include <string.h>
+
+/*
+Compressed data is a list of sequences, each one being:
+
+* A token, with the number of literals in the high nibble and the match
+  length minus MinMatch in the low nibble
+* More literal length bytes if the high nibble is 15, added until one is not 255
+* The literals
+* The match offset as 16-bit little endian, and more match length bytes if
+  the low nibble is 15
+
+The last sequence only has the token and the literals.
+*/
+
+enum {
+    MinMatch = 4,
+    MaxOffset = 65535,
+    HashBits = 14
+};
+
+static uint32_t read32(uint8_t const* const p) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+static uint32_t hash(uint32_t const value) {
+    return (value * 2654435761U) >> (32 - HashBits);
+}
+
+static uint8_t* putLength(uint8_t* dest, size_t length) {
+    while (length >= 255) {
+        *dest++ = 255;
+        length -= 255;
+    }
+
+    *dest++ = static_cast<uint8_t>(length);
+    return dest;
+}
+
+static bool getLength(uint8_t const** const source, uint8_t const* const end, size_t* const length) {
+    uint8_t byte;
+
+    do {
+        if (*source == end) {
+            return false;
+        }
+
+        byte = *(*source)++;
+        *length += byte;
+    }
+    while (byte == 255);
+
+    return true;
+}
+
+static uint8_t* putSequence(uint8_t* dest, uint8_t const* const literals, size_t const count, size_t const offset, size_t const length) {
+    uint8_t* const token = dest++;
+    *token = static_cast<uint8_t>((count < 15 ? count : 15) << 4);
+
+    if (count >= 15) {
+        dest = putLength(dest, count - 15);
+    }
+
+    memcpy(dest, literals, count);
+    dest += count;
+
+    if (length != 0) {
+        size_t const extra = length - MinMatch;
+        *token |= extra < 15 ? extra : 15;
+
+        *dest++ = offset & 0xff;
+        *dest++ = offset >> 8;
+
+        if (extra >= 15) {
+            dest = putLength(dest, extra - 15);
+        }
+    }
+
+    return dest;
+}
+
+size_t hc::Lz::bound(size_t const size) {
+    return size + size / 255 + 16;
+}
+
+size_t hc::Lz::compress(void const* const source, size_t const size, void* const dest, size_t const capacity) {
+    if (capacity < bound(size)) {
+        return 0;
+    }
+
+    uint8_t const* const src = static_cast<uint8_t const*>(source);
+    uint8_t* const begin = static_cast<uint8_t*>(dest);
+    uint8_t* out = begin;
+
+    uint32_t table[1 << HashBits];
+    memset(table, 0, sizeof(table));
+
+    size_t anchor = 0;
+    size_t pos = 0;
+    size_t misses = 0;
+
+    while (pos + MinMatch <= size) {
+        uint32_t const value = read32(src + pos);
+        uint32_t const h = hash(value);
+        size_t const candidate = table[h];
+        table[h] = static_cast<uint32_t>(pos);
+
+        if (candidate >= pos || pos - candidate > MaxOffset || read32(src + candidate) != value) {
+            // Skip faster over data that doesn't compress
+            pos += 1 + (misses++ >> 5);
+            continue;
+        }
+
+        size_t length = MinMatch;
+
+        while (pos + length < size && src[candidate + length] == src[pos + length]) {
+            length++;
+        }
+
+        out = putSequence(out, src + anchor, pos - anchor, pos - candidate, length);
+        pos += length;
+        anchor = pos;
+        misses = 0;
+    }
+
+    out = putSequence(out, src + anchor, size - anchor, 0, 0);
+    return out - begin;
+}
+
+bool hc::Lz::decompress(void const* const source, size_t const compressed, void* const dest, size_t const size) {
+    uint8_t const* src = static_cast<uint8_t const*>(source);
+    uint8_t const* const end = src + compressed;
+    uint8_t* const out = static_cast<uint8_t*>(dest);
+    size_t pos = 0;
+
+    while (src < end) {
+        uint8_t const token = *src++;
+        size_t count = token >> 4;
+
+        if (count == 15 && !getLength(&src, end, &count)) {
+            return false;
+        }
+
+        if (count > static_cast<size_t>(end - src) || count > size - pos) {
+            return false;
+        }
+
+        memcpy(out + pos, src, count);
+        src += count;
+        pos += count;
+
+        if (src == end) {
+            // The last sequence doesn't have a match
+            break;
+        }
+
+        if (end - src < 2) {
+            return false;
+        }
+
+        size_t const offset = src[0] | src[1] << 8;
+        src += 2;
+
+        size_t length = token & 15;
+
+        if (length == 15 && !getLength(&src, end, &length)) {
+            return false;
+        }
+
+        length += MinMatch;
+
+        if (offset == 0 || offset > pos || length > size - pos) {
+            return false;
+        }
+
+        uint8_t* const to = out + pos;
+        uint8_t const* const from = to - offset;
+
+        if (offset == 1) {
+            memset(to, *from, length);
+        }
+        else if (offset >= length) {
+            memcpy(to, from, length);
+        }
+        else {
+            // Overlapping copy, repeats the last offset bytes
+            for (size_t i = 0; i < length; i++) {
+                to[i] = from[i];
+            }
+        }
+
+        pos += length;
+    }
+
+    return pos == size;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace hc {
+    // A small LZ77 codec in the spirit of LZ4, used to compress savestates.
+    // It favors speed over ratio, and long runs of zeros such as the ones in
+    // XOR deltas of savestates compress to almost nothing.
+    class Lz final {
+    public:
+        // Worst case size of the compressed data
+        static size_t bound(size_t const size);
+
+        // Returns the compressed size, or zero if capacity is less than
+        // bound(size)
+        static size_t compress(void const* const source, size_t const size, void* const dest, size_t const capacity);
+
+        // The decompressed data must have exactly size bytes
+        static bool decompress(void const* const source, size_t const compressed, void* const dest, size_t const size);
+    };
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+
+namespace hc {
+    // Lock-free triple buffer used to hand the latest value of T from one
+    // producer thread to one consumer thread. The producer never waits, and
+    // values not seen by the consumer are overwritten by newer ones.
+    template<typename T>
+    class Mailbox final {
+    public:
+        Mailbox() : _buffers(), _writeIndex(0), _readyIndex(1), _readIndex(2) {}
+
+        // Producer side
+        T& writeBuffer() {
+            return _buffers[_writeIndex];
+        }
+
+        void publish() {
+            unsigned const ready = _readyIndex.exchange(_writeIndex | Fresh, std::memory_order_acq_rel);
+            _writeIndex = ready & ~Fresh;
+        }
+
+        // True if the consumer has already taken the last published value
+        bool consumed() const {
+            return (_readyIndex.load(std::memory_order_relaxed) & Fresh) == 0;
+        }
+
+        // Consumer side, returns nullptr if nothing was published since the
+        // last call
+        T const* acquire() {
+            if ((_readyIndex.load(std::memory_order_relaxed) & Fresh) == 0) {
+                return nullptr;
+            }
+
+            unsigned const ready = _readyIndex.exchange(_readIndex, std::memory_order_acq_rel);
+            _readIndex = ready & ~Fresh;
+            return &_buffers[_readIndex];
+        }
+
+        // The last value acquired by the consumer
+        T const& readBuffer() const {
+            return _buffers[_readIndex];
+        }
+
+    protected:
+        enum : unsigned {
+            // Set in _readyIndex when the buffer hasn't been seen by the consumer
+            Fresh = 4
+        };
+
+        T _buffers[3];
+        unsigned _writeIndex;
+        std::atomic<unsigned> _readyIndex;
+        unsigned _readIndex;
+    };
+}
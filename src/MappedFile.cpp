@@ -0,0 +1,149 @@
+#include "MappedFile.h"
+
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
+#define HC_MAPPED_WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+hc::MappedFile::MappedFile()
+    : _data(nullptr)
+    , _size(0)
+#ifdef HC_MAPPED_WIN32
+    , _file(INVALID_HANDLE_VALUE)
+    , _mapping(nullptr)
+#else
+    , _fd(-1)
+#endif
+{}
+
+hc::MappedFile::~MappedFile() {
+    close();
+}
+
+#ifdef HC_MAPPED_WIN32
+
+bool hc::MappedFile::open(char const* const path, std::string* const error, bool const sequential) {
+    (void)sequential;
+    close();
+
+    _file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (_file == INVALID_HANDLE_VALUE) {
+        *error = "error opening the file";
+        return false;
+    }
+
+    LARGE_INTEGER size;
+
+    if (!GetFileSizeEx(_file, &size)) {
+        *error = "error getting the file size";
+        close();
+        return false;
+    }
+
+    _size = static_cast<size_t>(size.QuadPart);
+
+    if (_size == 0) {
+        // Empty files can't be mapped
+        return true;
+    }
+
+    _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    _data = _mapping != nullptr ? MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+    if (_data == nullptr) {
+        *error = "error mapping the file";
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void hc::MappedFile::close() {
+    if (_data != nullptr) {
+        UnmapViewOfFile(_data);
+    }
+
+    if (_mapping != nullptr) {
+        CloseHandle(_mapping);
+    }
+
+    if (_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(_file);
+    }
+
+    _data = nullptr;
+    _size = 0;
+    _file = INVALID_HANDLE_VALUE;
+    _mapping = nullptr;
+}
+
+#else
+
+bool hc::MappedFile::open(char const* const path, std::string* const error, bool const sequential) {
+    close();
+
+    _fd = ::open(path, O_RDONLY);
+
+    if (_fd < 0) {
+        *error = strerror(errno);
+        return false;
+    }
+
+    struct stat st;
+
+    if (fstat(_fd, &st) != 0) {
+        *error = strerror(errno);
+        close();
+        return false;
+    }
+
+    _size = static_cast<size_t>(st.st_size);
+
+    if (_size == 0) {
+        // Empty files can't be mapped
+        return true;
+    }
+
+    void* const data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+
+    if (data == MAP_FAILED) {
+        *error = strerror(errno);
+        close();
+        return false;
+    }
+
+    _data = data;
+
+    if (sequential) {
+        // Only hints, failures don't matter
+        madvise(data, _size, MADV_SEQUENTIAL);
+        madvise(data, _size, MADV_WILLNEED);
+    }
+
+    return true;
+}
+
+void hc::MappedFile::close() {
+    if (_data != nullptr) {
+        munmap(const_cast<void*>(_data), _size);
+    }
+
+    if (_fd >= 0) {
+        ::close(_fd);
+    }
+
+    _data = nullptr;
+    _size = 0;
+    _fd = -1;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace hc {
+    // A read-only view of a whole file mapped into memory, the file is
+    // unmapped when the object is destroyed
+    class MappedFile final {
+    public:
+        MappedFile();
+        ~MappedFile();
+
+        // Sequential tells the OS that the whole file will be read from the
+        // start soon, so it can read ahead
+        bool open(char const* const path, std::string* const error, bool const sequential = false);
+        void close();
+
+        void const* data() const { return _data; }
+        size_t size() const { return _size; }
+
+    protected:
+        MappedFile(MappedFile const&) = delete;
+        MappedFile& operator=(MappedFile const&) = delete;
+
+        void const* _data;
+        size_t _size;
+
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
+        void* _file;
+        void* _mapping;
+#else
+        int _fd;
+#endif
+    };
+}
@@ -545,3 +545,8 @@ void hc::MemoryWatch::onDraw() {
     _editor.DrawContents(memory, memory->size(), memory->base());
     _sparkline.draw("#sparkline", ImGui::GetContentRegionAvail());
 }
+
+bool hc::MemoryWatch::wantsTurboFrames() const {
+    // Sampling every frame for the sparkline is pointless in turbo mode
+    return false;
+}
@@ -93,6 +93,7 @@ namespace hc {
         virtual char const* getTitle() override;
         virtual void onFrame() override;
         virtual void onDraw() override;
+        virtual bool wantsTurboFrames() const override;
 
     protected:
         enum {
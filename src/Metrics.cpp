@@ -0,0 +1,634 @@
+#include "Metrics.h"
+#include "Audio.h"
+#include "Trace.h"
+
+#include <IconsFontAwesome4.h>
+#include <imgui.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
+#define HC_METRICS_WIN32
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+// macOS uses the SO_NOSIGPIPE socket option instead
+#define MSG_NOSIGNAL 0
+#endif
+
+extern "C" {
+    #include <lauxlib.h>
+}
+
+#define TAG "[MET] "
+
+namespace {
+    enum {
+        // How often the exporter thread checks for clients while listening
+        PollMs = 50,
+        // Clients that don't send their request in this time get the metrics
+        // anyway
+        RequestMs = 100
+    };
+
+    void appendf(std::string* const text, char const* const format, ...) {
+        char buffer[512];
+
+        va_list args;
+        va_start(args, format);
+        int const length = vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+
+        if (length > 0) {
+            size_t const written = static_cast<size_t>(length);
+            text->append(buffer, written < sizeof(buffer) ? written : sizeof(buffer) - 1);
+        }
+    }
+
+    void appendLabel(std::string* const text, char const* value) {
+        for (; *value != 0; value++) {
+            switch (*value) {
+                case '\\': text->append("\\\\"); break;
+                case '"': text->append("\\\""); break;
+                case '\n': text->append("\\n"); break;
+                default: text->push_back(*value); break;
+            }
+        }
+    }
+
+    void appendHeader(std::string* const text, char const* const name, char const* const type, char const* const help) {
+        appendf(text, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    }
+
+    // Resident set size of the process, zero if unknown
+    uint64_t residentBytes() {
+#if defined(__linux__)
+        FILE* const file = fopen("/proc/self/statm", "r");
+
+        if (file == nullptr) {
+            return 0;
+        }
+
+        unsigned long size = 0, resident = 0;
+        int const count = fscanf(file, "%lu %lu", &size, &resident);
+        fclose(file);
+
+        return count == 2 ? static_cast<uint64_t>(resident) * static_cast<uint64_t>(sysconf(_SC_PAGESIZE)) : 0;
+#elif defined(__APPLE__)
+        mach_task_basic_info_data_t info;
+        mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+
+        if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS) {
+            return 0;
+        }
+
+        return info.resident_size;
+#else
+        return 0;
+#endif
+    }
+}
+
+hc::Metrics::Metrics(Desktop* desktop)
+    : View(desktop)
+    , _perf(nullptr)
+    , _audio(nullptr)
+    , _L(nullptr)
+    , _mode(Mode::Stopped)
+    , _interval(0)
+    , _next(0)
+    , _seconds(10.0f)
+    , _pending(false)
+    , _quit(false)
+    , _listener(-1)
+    , _exported(0)
+    , _served(0)
+{
+    strcpy(_path, "hackcon.prom");
+    strcpy(_address, "9464");
+}
+
+void hc::Metrics::init(Perf* const perf, Audio* const audio, lua_State* const L) {
+    _perf = perf;
+    _audio = audio;
+    _L = L;
+}
+
+bool hc::Metrics::exportToFile(char const* const path, double const seconds) {
+    stop();
+
+    _target = path;
+    start(Mode::File, seconds);
+
+    _desktop->info(TAG "Exporting metrics to \"%s\" every %.3f seconds", path, seconds);
+    return true;
+}
+
+bool hc::Metrics::listen(char const* const address, double const seconds) {
+    stop();
+
+    _target = address;
+    std::string error;
+
+    if (!openListener(&error)) {
+        _desktop->error(TAG "Error listening on \"%s\": %s", address, error.c_str());
+        return false;
+    }
+
+    start(Mode::Socket, seconds);
+
+    _desktop->info(TAG "Serving metrics on \"%s\", collected every %.3f seconds", address, seconds);
+    return true;
+}
+
+void hc::Metrics::stop() {
+    if (_exporterThread.joinable()) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _quit = true;
+        }
+
+        _gate.notify_one();
+        _exporterThread.join();
+    }
+
+    closeListener();
+    _mode = Mode::Stopped;
+}
+
+hc::Metrics* hc::Metrics::check(lua_State* const L, int const index) {
+    return *static_cast<Metrics**>(luaL_checkudata(L, index, "hc::Metrics"));
+}
+
+char const* hc::Metrics::getTitle() {
+    return ICON_FA_LINE_CHART " Metrics";
+}
+
+void hc::Metrics::onFrame() {
+    if (_mode != Mode::Stopped && Perf::getTimeNs() >= _next) {
+        collect();
+    }
+}
+
+void hc::Metrics::onDraw() {
+    // Also collect here so metrics keep flowing while the game is paused
+    onFrame();
+
+    ImGui::SliderFloat("##Interval", &_seconds, 1.0f, 60.0f, "Every %.0f seconds");
+
+    ImGui::InputText("##path", _path, sizeof(_path));
+    ImGui::SameLine();
+
+    if (ImGui::Button(ICON_FA_FLOPPY_O " Export to file")) {
+        exportToFile(_path, _seconds);
+    }
+
+    ImGui::InputText("##address", _address, sizeof(_address));
+    ImGui::SameLine();
+
+    if (ImGui::Button(ICON_FA_PLUG " Listen")) {
+        listen(_address, _seconds);
+    }
+
+    if (_mode == Mode::Stopped) {
+        ImGui::Text("Stopped");
+        return;
+    }
+
+    if (ImGui::Button(ICON_FA_STOP " Stop")) {
+        stop();
+        return;
+    }
+
+    ImGui::SameLine();
+
+    if (_mode == Mode::File) {
+        ImGui::Text("Exported %" PRIu64 " times to \"%s\"", _exported.load(), _target.c_str());
+    }
+    else {
+        ImGui::Text("Served %" PRIu64 " scrapes on \"%s\"", _served.load(), _target.c_str());
+    }
+}
+
+void hc::Metrics::onQuit() {
+    stop();
+}
+
+int hc::Metrics::push(lua_State* const L) {
+    auto const self = static_cast<Metrics**>(lua_newuserdata(L, sizeof(Metrics*)));
+    *self = this;
+
+    if (luaL_newmetatable(L, "hc::Metrics")) {
+        static luaL_Reg const methods[] = {
+            {"exportToFile", l_exportToFile},
+            {"listen", l_listen},
+            {"stop", l_stop},
+            {"text", l_text},
+            {nullptr, nullptr}
+        };
+
+        luaL_newlib(L, methods);
+        lua_setfield(L, -2, "__index");
+    }
+
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+void hc::Metrics::start(Mode const mode, double const seconds) {
+    _mode = mode;
+    _interval = static_cast<uint64_t>((seconds > 0.1 ? seconds : 0.1) * 1000000000.0);
+    _next = 0;
+    _exported = 0;
+    _served = 0;
+
+    _job.clear();
+    _pending = false;
+    _quit = false;
+    _exporterThread = std::thread(&Metrics::exporter, this);
+}
+
+void hc::Metrics::collect() {
+    Trace::Scope scope("Metrics::collect");
+
+    _next = Perf::getTimeNs() + _interval;
+    format(&_text);
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _job = _text;
+        _pending = true;
+    }
+
+    _gate.notify_one();
+}
+
+void hc::Metrics::format(std::string* const text) {
+    text->clear();
+
+    _perf->getCounters(&_counters);
+
+    appendHeader(text, "hc_perf_calls_total", "counter", "Number of times each perf counter was stopped.");
+
+    for (auto const& counter : _counters) {
+        text->append("hc_perf_calls_total{counter=\"");
+        appendLabel(text, counter.ident);
+        appendf(text, "\"} %" PRIu64 "\n", counter.calls);
+    }
+
+    appendHeader(text, "hc_perf_seconds_total", "counter", "Total time measured by each perf counter.");
+
+    for (auto const& counter : _counters) {
+        text->append("hc_perf_seconds_total{counter=\"");
+        appendLabel(text, counter.ident);
+        appendf(text, "\"} %.9f\n", counter.total / 1e9);
+    }
+
+    appendHeader(text, "hc_perf_seconds", "summary", "Distribution of the times of each perf counter since its statistics were reset.");
+
+    static double const quantiles[] = {0.5, 0.95, 0.99};
+
+    for (auto const& counter : _counters) {
+        if (!counter.stopped) {
+            continue;
+        }
+
+        for (auto const quantile : quantiles) {
+            text->append("hc_perf_seconds{counter=\"");
+            appendLabel(text, counter.ident);
+            appendf(text, "\",quantile=\"%g\"} %.9f\n", quantile, counter.histogram.percentile(quantile * 100.0) / 1e9);
+        }
+
+        text->append("hc_perf_seconds_sum{counter=\"");
+        appendLabel(text, counter.ident);
+        appendf(text, "\"} %.9f\n", counter.histogram.mean() * counter.histogram.count() / 1e9);
+
+        text->append("hc_perf_seconds_count{counter=\"");
+        appendLabel(text, counter.ident);
+        appendf(text, "\"} %" PRIu64 "\n", counter.histogram.count());
+    }
+
+    Audio::Health const health = _audio->health();
+
+    appendHeader(text, "hc_audio_underruns_total", "counter", "Audio device callbacks that found the FIFO empty.");
+    appendf(text, "hc_audio_underruns_total %" PRIu64 "\n", health.underruns);
+
+    appendHeader(text, "hc_audio_overruns_total", "counter", "Resampled audio that didn't fit in the FIFO.");
+    appendf(text, "hc_audio_overruns_total %" PRIu64 "\n", health.overruns);
+
+    appendHeader(text, "hc_audio_dropped_frames_total", "counter", "Audio frames from the core dropped before resampling.");
+    appendf(text, "hc_audio_dropped_frames_total %" PRIu64 "\n", health.droppedFrames);
+
+    appendHeader(text, "hc_audio_fifo_frames", "gauge", "Audio frames queued in the FIFO.");
+    appendf(text, "hc_audio_fifo_frames %zu\n", health.occupancy);
+
+    appendHeader(text, "hc_audio_fifo_capacity_frames", "gauge", "Audio frames that fit in the FIFO.");
+    appendf(text, "hc_audio_fifo_capacity_frames %zu\n", health.capacity);
+
+    appendHeader(text, "hc_audio_latency_seconds", "gauge", "Audio queued ahead of the samples last resampled.");
+    appendf(text, "hc_audio_latency_seconds %.6f\n", health.latency / 1000.0);
+
+    appendHeader(text, "hc_audio_resample_ratio", "gauge", "Current resampling ratio.");
+    appendf(text, "hc_audio_resample_ratio %.9f\n", health.ratio);
+
+    appendHeader(text, "hc_fps", "gauge", "Frames per second drawn by the UI and run by the core.");
+    appendf(text, "hc_fps{source=\"draw\"} %.3f\n", _desktop->drawFps());
+    appendf(text, "hc_fps{source=\"game\"} %.3f\n", _desktop->frameFps());
+
+    appendHeader(text, "hc_lua_memory_bytes", "gauge", "Memory in use by the Lua state.");
+    // In 64 bits, the count in KiB times 1024 overflows an int past 2 GiB
+    uint64_t const luaBytes = static_cast<uint64_t>(lua_gc(_L, LUA_GCCOUNT, 0)) * 1024 + static_cast<uint64_t>(lua_gc(_L, LUA_GCCOUNTB, 0));
+    appendf(text, "hc_lua_memory_bytes %" PRIu64 "\n", luaBytes);
+
+    uint64_t const resident = residentBytes();
+
+    if (resident != 0) {
+        appendHeader(text, "hc_process_resident_bytes", "gauge", "Resident memory of the process, including the core.");
+        appendf(text, "hc_process_resident_bytes %" PRIu64 "\n", resident);
+    }
+}
+
+void hc::Metrics::exporter() {
+    Trace::setThreadName("metrics");
+
+    std::string text;
+    bool failing = false;
+
+    for (;;) {
+        bool collected = false;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto const ready = [this]() { return _pending || _quit; };
+
+            if (_listener >= 0) {
+                _gate.wait_for(lock, std::chrono::milliseconds(PollMs), ready);
+            }
+            else {
+                _gate.wait(lock, ready);
+            }
+
+            if (_quit) {
+                return;
+            }
+
+            if (_pending) {
+                text.swap(_job);
+                _pending = false;
+                collected = true;
+            }
+        }
+
+        if (_mode == Mode::File && collected) {
+            bool const ok = writeFile(text);
+
+            if (!ok && !failing) {
+                _desktop->error(TAG "Error exporting metrics to \"%s\": %s", _target.c_str(), strerror(errno));
+            }
+
+            failing = !ok;
+            _exported += ok;
+        }
+        else if (_mode == Mode::Socket) {
+            serve(text);
+        }
+    }
+}
+
+bool hc::Metrics::writeFile(std::string const& text) {
+    // Scrapers must never see a partial file
+    std::string const tempPath = _target + ".tmp";
+    FILE* const file = fopen(tempPath.c_str(), "wb");
+
+    if (file == nullptr) {
+        return false;
+    }
+
+    bool const ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+
+    if (fclose(file) != 0 || !ok) {
+        remove(tempPath.c_str());
+        return false;
+    }
+
+#ifdef HC_METRICS_WIN32
+    // rename doesn't replace existing files on Windows
+    remove(_target.c_str());
+#endif
+
+    if (rename(tempPath.c_str(), _target.c_str()) != 0) {
+        remove(tempPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+#ifdef HC_METRICS_WIN32
+bool hc::Metrics::openListener(std::string* const error) {
+    *error = "sockets are not supported on Windows, export to a file instead";
+    return false;
+}
+
+void hc::Metrics::closeListener() {}
+
+void hc::Metrics::serve(std::string const& text) {
+    (void)text;
+}
+#else
+static bool isSocket(char const* const path) {
+    struct stat st;
+    return lstat(path, &st) == 0 && S_ISSOCK(st.st_mode);
+}
+
+bool hc::Metrics::openListener(std::string* const error) {
+    char const* const address = _target.c_str();
+    char* end = nullptr;
+    unsigned long const port = strtoul(address, &end, 10);
+    bool const tcp = *address != 0 && *end == 0;
+
+    int const fd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0) {
+        *error = strerror(errno);
+        return false;
+    }
+
+    int result = -1;
+
+    if (tcp) {
+        int const yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+        // Only local tools can scrape
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        result = port <= 65535 ? bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) : -1;
+        errno = port <= 65535 ? errno : EINVAL;
+    }
+    else {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+
+        struct stat st;
+
+        if (_target.size() >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+        }
+        else if (lstat(address, &st) == 0 && !S_ISSOCK(st.st_mode)) {
+            // Only stale sockets are replaced, never other files
+            errno = EEXIST;
+        }
+        else {
+            strcpy(addr.sun_path, address);
+
+            if (isSocket(address)) {
+                unlink(address);
+            }
+
+            result = bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+        }
+    }
+
+    if (result != 0 || ::listen(fd, 4) != 0 || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+        *error = strerror(errno);
+        ::close(fd);
+        return false;
+    }
+
+    _listener = fd;
+    return true;
+}
+
+void hc::Metrics::closeListener() {
+    if (_listener < 0) {
+        return;
+    }
+
+    ::close(_listener);
+    _listener = -1;
+
+    if (_mode == Mode::Socket && !_target.empty() && _target.find_first_not_of("0123456789") != std::string::npos && isSocket(_target.c_str())) {
+        unlink(_target.c_str());
+    }
+}
+
+void hc::Metrics::serve(std::string const& text) {
+    for (;;) {
+        int const client = accept(_listener, nullptr, nullptr);
+
+        if (client < 0) {
+            // EAGAIN when there are no more clients waiting
+            return;
+        }
+
+        // Some systems make accepted sockets inherit O_NONBLOCK
+        fcntl(client, F_SETFL, fcntl(client, F_GETFL) & ~O_NONBLOCK);
+
+#ifdef SO_NOSIGPIPE
+        int const yes = 1;
+        setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+#endif
+
+        // Consume the HTTP request, if any, so closing doesn't reset the
+        // connection before the client reads the response
+        struct pollfd request = {client, POLLIN, 0};
+        char buffer[1024];
+        size_t received = 0;
+
+        while (received < sizeof(buffer) - 1 && poll(&request, 1, RequestMs) > 0) {
+            ssize_t const count = recv(client, buffer + received, sizeof(buffer) - 1 - received, 0);
+
+            if (count <= 0) {
+                break;
+            }
+
+            received += static_cast<size_t>(count);
+            buffer[received] = 0;
+
+            if (strstr(buffer, "\r\n\r\n") != nullptr) {
+                break;
+            }
+        }
+
+        std::string response;
+        appendf(&response, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", text.size());
+        response += text;
+
+        size_t sent = 0;
+
+        while (sent < response.size()) {
+            ssize_t const count = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+
+            if (count <= 0) {
+                break;
+            }
+
+            sent += static_cast<size_t>(count);
+        }
+
+        ::close(client);
+        _served += sent == response.size();
+    }
+}
+#endif
+
+int hc::Metrics::l_exportToFile(lua_State* const L) {
+    auto const self = check(L, 1);
+    char const* const path = luaL_checkstring(L, 2);
+    lua_Number const seconds = luaL_optnumber(L, 3, 10.0);
+
+    lua_pushboolean(L, self->exportToFile(path, seconds));
+    return 1;
+}
+
+int hc::Metrics::l_listen(lua_State* const L) {
+    auto const self = check(L, 1);
+    char const* const address = luaL_checkstring(L, 2);
+    lua_Number const seconds = luaL_optnumber(L, 3, 10.0);
+
+    lua_pushboolean(L, self->listen(address, seconds));
+    return 1;
+}
+
+int hc::Metrics::l_stop(lua_State* const L) {
+    auto const self = check(L, 1);
+    self->stop();
+    return 0;
+}
+
+int hc::Metrics::l_text(lua_State* const L) {
+    auto const self = check(L, 1);
+
+    // Always up to date, even if the exporter is stopped
+    std::string text;
+    self->format(&text);
+
+    lua_pushlstring(L, text.data(), text.size());
+    return 1;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "Desktop.h"
+#include "Scriptable.h"
+#include "Perf.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+extern "C" {
+    #include <lua.h>
+}
+
+namespace hc {
+    class Audio;
+
+    // Exports the perf counters, the audio health, the frame rates and the
+    // memory in use in the Prometheus text format, either to a file that is
+    // replaced atomically or to clients of a local socket. Metrics are
+    // collected every few seconds with the core mutex held, and written or
+    // served by a background thread.
+    class Metrics : public View, public Scriptable {
+    public:
+        Metrics(Desktop* desktop);
+        virtual ~Metrics() {}
+
+        void init(Perf* const perf, Audio* const audio, lua_State* const L);
+
+        // Must be called with the core mutex held
+        bool exportToFile(char const* const path, double const seconds);
+        bool listen(char const* const address, double const seconds);
+        void stop();
+
+        static Metrics* check(lua_State* const L, int const index);
+
+        // hc::View
+        virtual char const* getTitle() override;
+        virtual void onFrame() override;
+        virtual void onDraw() override;
+        virtual void onQuit() override;
+
+        // hc::Scriptable
+        virtual int push(lua_State* const L) override;
+
+    protected:
+        enum class Mode {
+            Stopped,
+            File,
+            Socket
+        };
+
+        void start(Mode const mode, double const seconds);
+        void collect();
+        void format(std::string* const text);
+
+        void exporter();
+        bool writeFile(std::string const& text);
+        bool openListener(std::string* const error);
+        void closeListener();
+        void serve(std::string const& text);
+
+        static int l_exportToFile(lua_State* const L);
+        static int l_listen(lua_State* const L);
+        static int l_stop(lua_State* const L);
+        static int l_text(lua_State* const L);
+
+        Perf* _perf;
+        Audio* _audio;
+        lua_State* _L;
+
+        Mode _mode;
+        std::string _target;
+        uint64_t _interval;
+        uint64_t _next;
+        std::string _text;
+        std::vector<Perf::CounterInfo> _counters;
+
+        char _path[256];
+        char _address[256];
+        float _seconds;
+
+        // The exporter thread swaps _job with the text it writes or serves
+        std::thread _exporterThread;
+        std::mutex _mutex;
+        std::condition_variable _gate;
+        std::string _job;
+        bool _pending;
+        bool _quit;
+        int _listener;
+        std::atomic<uint64_t> _exported;
+        std::atomic<uint64_t> _served;
+    };
+}
@@ -0,0 +1,239 @@
+#include "Movie.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+static uint32_t const movieVersion = 1;
+static size_t const headerSize = 28;
+
+static void put32(uint8_t* const p, uint32_t const value) {
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+static uint32_t get32(uint8_t const* const p) {
+    return static_cast<uint32_t>(p[0])
+         | static_cast<uint32_t>(p[1]) << 8
+         | static_cast<uint32_t>(p[2]) << 16
+         | static_cast<uint32_t>(p[3]) << 24;
+}
+
+static bool readBlob(FILE* const file, std::vector<uint8_t>* const blob, uint32_t const size) {
+    blob->resize(size);
+    return size == 0 || fread(blob->data(), 1, size, file) == size;
+}
+
+hc::Movie::Movie()
+    : _mode(Mode::Idle)
+    , _frameSize(0)
+    , _frames(0)
+    , _position(0)
+    , _repeat(0)
+    , _offset(0)
+{}
+
+void hc::Movie::record(
+    char const* const path,
+    size_t const frameSize,
+    void const* const anchor, size_t const anchorSize,
+    void const* const state, size_t const stateSize) {
+
+    _mode = Mode::Recording;
+    _path = path;
+    _frameSize = frameSize;
+
+    _anchor.assign(static_cast<uint8_t const*>(anchor), static_cast<uint8_t const*>(anchor) + anchorSize);
+    _state.assign(static_cast<uint8_t const*>(state), static_cast<uint8_t const*>(state) + stateSize);
+    _stream.clear();
+    _previous.assign(frameSize, 0);
+
+    _frames = _position = _repeat = 0;
+    _offset = 0;
+}
+
+void hc::Movie::add(uint8_t const* const frame) {
+    if (_frames != 0 && memcmp(frame, _previous.data(), _frameSize) == 0) {
+        _repeat++;
+        _frames++;
+        return;
+    }
+
+    if (_frames != 0) {
+        // Close the previous record with the number of frames it repeated
+        putVarint(_repeat);
+        _repeat = 0;
+    }
+
+    uint32_t changed = 0;
+
+    for (size_t i = 0; i < _frameSize; i++) {
+        changed += frame[i] != _previous[i];
+    }
+
+    putVarint(changed);
+    size_t last = 0;
+
+    for (size_t i = 0; i < _frameSize; i++) {
+        if (frame[i] != _previous[i]) {
+            // Gaps are relative to the byte after the last change
+            putVarint(static_cast<uint32_t>(i - last));
+            _stream.push_back(frame[i] ^ _previous[i]);
+            last = i + 1;
+        }
+    }
+
+    memcpy(_previous.data(), frame, _frameSize);
+    _frames++;
+}
+
+bool hc::Movie::load(char const* const path, size_t const frameSize, std::string* const error) {
+    _mode = Mode::Idle;
+    FILE* const file = fopen(path, "rb");
+
+    if (file == nullptr) {
+        *error = strerror(errno);
+        return false;
+    }
+
+    uint8_t header[headerSize];
+
+    if (fread(header, 1, headerSize, file) != headerSize || memcmp(header, "HCMV", 4) != 0) {
+        fclose(file);
+        *error = "not a movie file";
+        return false;
+    }
+
+    if (get32(header + 4) != movieVersion || get32(header + 8) != frameSize) {
+        fclose(file);
+        *error = "unsupported movie version or input layout";
+        return false;
+    }
+
+    bool const ok = readBlob(file, &_anchor, get32(header + 16)) &&
+                    readBlob(file, &_state, get32(header + 20)) &&
+                    readBlob(file, &_stream, get32(header + 24));
+
+    fclose(file);
+
+    if (!ok) {
+        *error = "truncated movie file";
+        return false;
+    }
+
+    _mode = Mode::Replaying;
+    _path = path;
+    _frameSize = frameSize;
+    _previous.assign(frameSize, 0);
+
+    _frames = get32(header + 12);
+    _position = _repeat = 0;
+    _offset = 0;
+    return true;
+}
+
+bool hc::Movie::next(uint8_t* const frame) {
+    if (_repeat != 0) {
+        _repeat--;
+    }
+    else {
+        uint32_t changed;
+
+        if (_offset >= _stream.size() || !getVarint(&changed)) {
+            return false;
+        }
+
+        size_t index = 0;
+
+        for (uint32_t i = 0; i < changed; i++) {
+            uint32_t gap;
+
+            if (!getVarint(&gap) || index + gap >= _frameSize || _offset >= _stream.size()) {
+                return false;
+            }
+
+            index += gap;
+            _previous[index++] ^= _stream[_offset++];
+        }
+
+        if (!getVarint(&_repeat)) {
+            return false;
+        }
+    }
+
+    memcpy(frame, _previous.data(), _frameSize);
+    _position++;
+    return true;
+}
+
+bool hc::Movie::stop(std::string* const error) {
+    Mode const mode = _mode;
+    _mode = Mode::Idle;
+
+    if (mode != Mode::Recording) {
+        return true;
+    }
+
+    if (_frames != 0) {
+        putVarint(_repeat);
+    }
+
+    FILE* const file = fopen(_path.c_str(), "wb");
+
+    if (file == nullptr) {
+        *error = strerror(errno);
+        return false;
+    }
+
+    uint8_t header[headerSize];
+    memcpy(header, "HCMV", 4);
+    put32(header + 4, movieVersion);
+    put32(header + 8, static_cast<uint32_t>(_frameSize));
+    put32(header + 12, _frames);
+    put32(header + 16, static_cast<uint32_t>(_anchor.size()));
+    put32(header + 20, static_cast<uint32_t>(_state.size()));
+    put32(header + 24, static_cast<uint32_t>(_stream.size()));
+
+    bool const ok = fwrite(header, 1, headerSize, file) == headerSize &&
+                    fwrite(_anchor.data(), 1, _anchor.size(), file) == _anchor.size() &&
+                    fwrite(_state.data(), 1, _state.size(), file) == _state.size() &&
+                    fwrite(_stream.data(), 1, _stream.size(), file) == _stream.size();
+
+    if (fclose(file) != 0 || !ok) {
+        *error = strerror(errno);
+        return false;
+    }
+
+    return true;
+}
+
+void hc::Movie::putVarint(uint32_t value) {
+    while (value >= 0x80) {
+        _stream.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+
+    _stream.push_back(static_cast<uint8_t>(value));
+}
+
+bool hc::Movie::getVarint(uint32_t* const value) {
+    uint32_t result = 0;
+
+    for (unsigned shift = 0; shift < 35; shift += 7) {
+        if (_offset >= _stream.size()) {
+            return false;
+        }
+
+        uint8_t const byte = _stream[_offset++];
+        result |= static_cast<uint32_t>(byte & 0x7f) << shift;
+
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace hc {
+    // Records and replays a stream of fixed-size input frames. Each frame is
+    // stored as the bytes that changed since the previous one, followed by
+    // how many frames didn't change after it, so idle input costs nothing.
+    // Movies can be anchored to a savestate and carry an opaque blob with the
+    // state of the recorder at the time the recording started.
+    class Movie final {
+    public:
+        Movie();
+
+        // Recording, the movie is saved to path when stopped
+        void record(
+            char const* const path,
+            size_t const frameSize,
+            void const* const anchor, size_t const anchorSize,
+            void const* const state, size_t const stateSize
+        );
+
+        void add(uint8_t const* const frame);
+
+        // Replaying, returns false when there are no more frames
+        bool load(char const* const path, size_t const frameSize, std::string* const error);
+        bool next(uint8_t* const frame);
+
+        // Saves the movie if recording, and returns false on I/O errors
+        bool stop(std::string* const error);
+
+        bool recording() const { return _mode == Mode::Recording; }
+        bool replaying() const { return _mode == Mode::Replaying; }
+
+        uint32_t frames() const { return _frames; }
+        uint32_t position() const { return _position; }
+        size_t streamSize() const { return _stream.size(); }
+        char const* path() const { return _path.c_str(); }
+
+        std::vector<uint8_t> const& anchor() const { return _anchor; }
+        std::vector<uint8_t> const& state() const { return _state; }
+
+    protected:
+        enum class Mode {
+            Idle,
+            Recording,
+            Replaying
+        };
+
+        void putVarint(uint32_t value);
+        bool getVarint(uint32_t* const value);
+
+        Mode _mode;
+        std::string _path;
+        size_t _frameSize;
+
+        std::vector<uint8_t> _anchor;
+        std::vector<uint8_t> _state;
+        std::vector<uint8_t> _stream;
+
+        // The last frame recorded or replayed
+        std::vector<uint8_t> _previous;
+
+        uint32_t _frames;
+        uint32_t _position;
+        uint32_t _repeat;
+        size_t _offset;
+    };
+}
@@ -0,0 +1,194 @@
+#include "Pacer.h"
+#include "Video.h"
+
+#include <IconsFontAwesome4.h>
+
+#include <inttypes.h>
+#include <chrono>
+#include <thread>
+
+#define TAG "[PAC] "
+
+// Upper limits of the lateness histogram buckets, in microseconds
+static uint64_t const bucketLimits[hc::Pacer::Buckets - 1] = {
+    50, 100, 250, 500, 1000, 2000, 4000, 8000, 16000
+};
+
+hc::Pacer::Pacer(Desktop* desktop)
+    : View(desktop)
+    , _video(nullptr)
+    , _basePeriod(0)
+    , _period(0)
+    , _next(0)
+    , _speed(1.0)
+    , _catchUp(CatchUp::Run)
+    , _maxCatchUp(4)
+    , _spinUs(2000)
+{
+    reset();
+}
+
+void hc::Pacer::init(Video* const video) {
+    _video = video;
+}
+
+void hc::Pacer::setSpeed(double const speed) {
+    _speed = speed > 0.0 ? speed : 0.0;
+    _period = _speed > 0.0 ? static_cast<uint64_t>(_basePeriod / _speed) : 0;
+
+    // Start the new pace now instead of catching up with the old one
+    _next = now() + _period;
+    _desktop->info(TAG "Speed set to %f", _speed);
+}
+
+unsigned hc::Pacer::due() {
+    uint64_t const time = now();
+
+    if (_basePeriod == 0) {
+        return 0;
+    }
+    else if (_period == 0) {
+        // Unlimited speed, run one frame at a time so the UI can get the lock
+        _next = time;
+        return 1;
+    }
+    else if (time < _next) {
+        return 0;
+    }
+
+    uint64_t const late = (time - _next) / _period + 1;
+    uint64_t count = 1;
+
+    if (_catchUp == CatchUp::Run) {
+        count = late < static_cast<uint64_t>(_maxCatchUp) ? late : static_cast<uint64_t>(_maxCatchUp);
+    }
+
+    // Frames will run back to back starting now
+    for (uint64_t i = 0; i < count; i++) {
+        record(time - (_next + i * _period));
+    }
+
+    _skipped += late - count;
+    _next += late * _period;
+    return static_cast<unsigned>(count);
+}
+
+void hc::Pacer::sleepUntil(uint64_t const deadline, uint64_t const spinNs) {
+    for (;;) {
+        uint64_t const time = now();
+
+        if (time >= deadline) {
+            return;
+        }
+
+        uint64_t const remaining = deadline - time;
+
+        if (remaining > spinNs) {
+            // The OS scheduler isn't precise, wake up early and spin
+            std::this_thread::sleep_for(std::chrono::nanoseconds(remaining - spinNs));
+        }
+        else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+uint64_t hc::Pacer::now() {
+    auto const time = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+}
+
+char const* hc::Pacer::getTitle() {
+    return ICON_FA_CLOCK_O " Pacer";
+}
+
+void hc::Pacer::onGameStarted() {
+    double const fps = _video->getCoreFps();
+    _basePeriod = fps > 0.0 ? static_cast<uint64_t>(1000000000.0 / fps) : 0;
+    _period = _speed > 0.0 ? static_cast<uint64_t>(_basePeriod / _speed) : 0;
+    _next = now();
+
+    reset();
+    _desktop->info(TAG "Pacing frames every %" PRIu64 " ns", _basePeriod);
+}
+
+void hc::Pacer::onGameResumed() {
+    // Don't try to catch up with the time spent paused
+    _next = now() + _period;
+}
+
+void hc::Pacer::onDraw() {
+    static char const* const policies[] = {"Run late frames", "Drop late frames"};
+
+    int catchUp = static_cast<int>(_catchUp);
+    ImGui::Combo("Catch-up", &catchUp, policies, 2);
+    _catchUp = static_cast<CatchUp>(catchUp);
+
+    if (_catchUp == CatchUp::Run) {
+        ImGui::SliderInt("Max frames", &_maxCatchUp, 1, 16);
+    }
+
+    ImGui::SliderInt("Spin (us)", &_spinUs, 0, 5000);
+
+    ImGui::Text(
+        "%" PRIu64 " frames, %" PRIu64 " skipped, max lateness %.3f ms",
+        _frames, _skipped, _maxLateness / 1000000.0
+    );
+
+    ImGui::SameLine();
+
+    if (ImGui::Button(ICON_FA_TRASH_O " Reset")) {
+        reset();
+    }
+
+    ImGui::Separator();
+    ImGui::Columns(2);
+    ImGui::SetColumnWidth(0, 100.0f);
+
+    for (unsigned i = 0; i < Buckets; i++) {
+        if (i == Buckets - 1) {
+            ImGui::Text(">= %" PRIu64 " us", bucketLimits[Buckets - 2]);
+        }
+        else {
+            ImGui::Text("< %" PRIu64 " us", bucketLimits[i]);
+        }
+
+        ImGui::NextColumn();
+
+        float const fraction = _frames != 0 ? static_cast<float>(_histogram[i]) / _frames : 0.0f;
+        char overlay[32];
+        snprintf(overlay, sizeof(overlay), "%" PRIu64, _histogram[i]);
+
+        ImGui::ProgressBar(fraction, ImVec2(-1.0f, 0.0f), overlay);
+        ImGui::NextColumn();
+    }
+
+    ImGui::Columns(1);
+}
+
+void hc::Pacer::onGameUnloaded() {
+    _basePeriod = _period = 0;
+}
+
+void hc::Pacer::reset() {
+    for (unsigned i = 0; i < Buckets; i++) {
+        _histogram[i] = 0;
+    }
+
+    _frames = 0;
+    _skipped = 0;
+    _maxLateness = 0;
+}
+
+void hc::Pacer::record(uint64_t const lateness) {
+    uint64_t const us = lateness / 1000;
+    unsigned bucket = 0;
+
+    while (bucket < Buckets - 1 && us >= bucketLimits[bucket]) {
+        bucket++;
+    }
+
+    _histogram[bucket]++;
+    _frames++;
+    _maxLateness = lateness > _maxLateness ? lateness : _maxLateness;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Desktop.h"
+
+#include <stdint.h>
+
+namespace hc {
+    // Decides when the emulation thread must run core frames, using a
+    // monotonic clock, and keeps statistics about how late frames start
+    class Pacer : public View {
+    public:
+        enum {
+            // Lateness histogram buckets
+            Buckets = 10
+        };
+
+        Pacer(Desktop* desktop);
+        virtual ~Pacer() {}
+
+        void init(Video* const video);
+
+        // Returns how many frames must run now, which can be zero. Must be
+        // called with the core mutex held.
+        unsigned due();
+
+        // Time when the next frame is due, in nanoseconds
+        uint64_t next() const { return _next; }
+
+        // Speed multiplier, zero runs frames as fast as possible
+        void setSpeed(double const speed);
+        double speed() const { return _speed; }
+
+        // Faster than normal, slow motion isn't turbo
+        bool turbo() const { return _speed == 0.0 || _speed > 1.0; }
+
+        // The spin threshold, in nanoseconds
+        uint64_t spin() const { return static_cast<uint64_t>(_spinUs) * 1000; }
+
+        // Sleeps until the deadline, using a coarse sleep followed by a spin
+        // for the last spinNs nanoseconds
+        static void sleepUntil(uint64_t const deadline, uint64_t const spinNs);
+
+        // Monotonic time in nanoseconds
+        static uint64_t now();
+
+        // hc::View
+        virtual char const* getTitle() override;
+        virtual void onGameStarted() override;
+        virtual void onGameResumed() override;
+        virtual void onDraw() override;
+        virtual void onGameUnloaded() override;
+
+    protected:
+        enum class CatchUp {
+            // Run the late frames back to back, up to _maxCatchUp of them
+            Run,
+            // Run only one frame and skip the rest
+            Drop
+        };
+
+        void reset();
+        void record(uint64_t const lateness);
+
+        Video* _video;
+
+        uint64_t _basePeriod;
+        uint64_t _period;
+        uint64_t _next;
+        double _speed;
+
+        CatchUp _catchUp;
+        int _maxCatchUp;
+        int _spinUs;
+
+        uint64_t _histogram[Buckets];
+        uint64_t _frames;
+        uint64_t _skipped;
+        uint64_t _maxLateness;
+    };
+}
@@ -1,52 +1,319 @@
 #include "Perf.h"
 #include "Logger.h"
+#include "Trace.h"
 
 #include <IconsFontAwesome4.h>
 
+#include <errno.h>
 #include <inttypes.h>
+#include <string.h>
 #include <chrono>
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define HC_PERF_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+#endif
+
 extern "C" {
     #include "lauxlib.h"
 }
 
 #define TAG "[PRF] "
+#define HANDLE_MT "hc::Perf::Counter"
+
+static struct {char const* const name; uint64_t const bit;} const simdNames[] = {
+    {"MMX", RETRO_SIMD_MMX}, {"MMXEXT", RETRO_SIMD_MMXEXT}, {"SSE", RETRO_SIMD_SSE}, {"SSE2", RETRO_SIMD_SSE2},
+    {"SSE3", RETRO_SIMD_SSE3}, {"SSSE3", RETRO_SIMD_SSSE3}, {"SSE4", RETRO_SIMD_SSE4}, {"SSE42", RETRO_SIMD_SSE42},
+    {"AVX", RETRO_SIMD_AVX}, {"AVX2", RETRO_SIMD_AVX2}, {"AES", RETRO_SIMD_AES}, {"POPCNT", RETRO_SIMD_POPCNT},
+    {"MOVBE", RETRO_SIMD_MOVBE}, {"CMOV", RETRO_SIMD_CMOV}, {"NEON", RETRO_SIMD_NEON}, {"ASIMD", RETRO_SIMD_ASIMD}
+};
+
+#ifdef HC_PERF_X86
+
+static void cpuid(unsigned const leaf, unsigned const subleaf, unsigned regs[4]) {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuidex(info, static_cast<int>(leaf), static_cast<int>(subleaf));
+
+    for (unsigned i = 0; i < 4; i++) {
+        regs[i] = static_cast<unsigned>(info[i]);
+    }
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t xgetbv() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return static_cast<uint64_t>(edx) << 32 | eax;
+#endif
+}
+
+static uint64_t probeCpuFeatures(bool* const invariantTsc) {
+    unsigned regs[4];
+    cpuid(0, 0, regs);
+    unsigned const maxLeaf = regs[0];
+
+    cpuid(0x80000000U, 0, regs);
+    unsigned const maxExtLeaf = regs[0];
+
+    uint64_t features = 0;
+    *invariantTsc = false;
+
+    if (maxLeaf >= 1) {
+        cpuid(1, 0, regs);
+        unsigned const ecx = regs[2], edx = regs[3];
+
+        features |= (edx & 1U << 15) ? RETRO_SIMD_CMOV : 0;
+        features |= (edx & 1U << 23) ? RETRO_SIMD_MMX : 0;
+        // SSE implies the MMX extensions
+        features |= (edx & 1U << 25) ? RETRO_SIMD_SSE | RETRO_SIMD_MMXEXT : 0;
+        features |= (edx & 1U << 26) ? RETRO_SIMD_SSE2 : 0;
+        features |= (ecx & 1U << 0) ? RETRO_SIMD_SSE3 : 0;
+        features |= (ecx & 1U << 9) ? RETRO_SIMD_SSSE3 : 0;
+        features |= (ecx & 1U << 19) ? RETRO_SIMD_SSE4 : 0;
+        features |= (ecx & 1U << 20) ? RETRO_SIMD_SSE42 : 0;
+        features |= (ecx & 1U << 22) ? RETRO_SIMD_MOVBE : 0;
+        features |= (ecx & 1U << 23) ? RETRO_SIMD_POPCNT : 0;
+        features |= (ecx & 1U << 25) ? RETRO_SIMD_AES : 0;
+
+        // AVX also needs the OS to save the YMM registers
+        bool const avxOs = (ecx & 1U << 27) && (ecx & 1U << 28) && (xgetbv() & 6) == 6;
+        features |= avxOs ? RETRO_SIMD_AVX : 0;
+
+        if (avxOs && maxLeaf >= 7) {
+            cpuid(7, 0, regs);
+            features |= (regs[1] & 1U << 5) ? RETRO_SIMD_AVX2 : 0;
+        }
+    }
+
+    if (maxExtLeaf >= 0x80000001U) {
+        cpuid(0x80000001U, 0, regs);
+        features |= (regs[3] & 1U << 22) ? RETRO_SIMD_MMXEXT : 0;
+    }
+
+    if (maxExtLeaf >= 0x80000007U) {
+        cpuid(0x80000007U, 0, regs);
+        *invariantTsc = (regs[3] & 1U << 8) != 0;
+    }
+
+    return features;
+}
+
+#else
+
+static uint64_t probeCpuFeatures(bool* const invariantTsc) {
+    *invariantTsc = false;
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+    return RETRO_SIMD_NEON | RETRO_SIMD_ASIMD;
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    return RETRO_SIMD_NEON;
+#else
+    return 0;
+#endif
+}
+
+#endif
+
+hc::Perf::Perf(Desktop* desktop)
+    : View(desktop)
+    , _generation(0)
+    , _slotsUsed(0)
+    , _cpuFeatures(0)
+    , _tscHz(0.0)
+    , _invariantTsc(false)
+    , _resolutionNs(0)
+    , _traceSeconds(10)
+{
+    for (auto& slot : _slots) {
+        slot.counter.store(nullptr, std::memory_order_relaxed);
+        slot.stats = nullptr;
+    }
+
+    strcpy(_tracePath, "trace.json");
+}
 
-void hc::Perf::init() {}
+void hc::Perf::init() {
+    _cpuFeatures = probeCpuFeatures(&_invariantTsc);
+    calibrate();
+
+    std::string names;
+
+    for (auto const& simd : simdNames) {
+        if ((_cpuFeatures & simd.bit) != 0) {
+            names += ' ';
+            names += simd.name;
+        }
+    }
+
+    _desktop->info(TAG "CPU features:%s", names.empty() ? " none" : names.c_str());
+
+    if (_tscHz > 0.0) {
+        _desktop->info(TAG "Invariant TSC at %.3f MHz", _tscHz / 1000000.0);
+    }
+
+    _desktop->info(TAG "Clock resolution is %" PRIu64 " ns", _resolutionNs);
+}
 
 uint64_t hc::Perf::getTimeUs() {
-    auto const now_us = std::chrono::time_point_cast<std::chrono::microseconds>(std::chrono::system_clock::now());
-    return static_cast<int64_t>(now_us.time_since_epoch().count());
+    auto const now_us = std::chrono::time_point_cast<std::chrono::microseconds>(std::chrono::steady_clock::now());
+    return static_cast<uint64_t>(now_us.time_since_epoch().count());
 }
 
 uint64_t hc::Perf::getTimeNs() {
-    auto const now_ns = std::chrono::time_point_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now());
+    auto const now_ns = std::chrono::time_point_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now());
     return static_cast<uint64_t>(now_ns.time_since_epoch().count());
 }
 
+void hc::Perf::getCounters(std::vector<CounterInfo>* const counters) const {
+    counters->resize(_counters.size());
+    size_t index = 0;
+
+    for (auto const& pair : _counters) {
+        retro_perf_counter const* const counter = pair.second.counter;
+        Stats* const stats = pair.second.stats;
+        CounterInfo& info = (*counters)[index++];
+
+        info.ident = counter->ident;
+        info.calls = counter->call_cnt;
+        info.total = counter->total;
+        info.stopped = false;
+        info.histogram.reset();
+
+        // Copied so callers don't race with the threads stopping counters
+        if (stats != nullptr) {
+            std::lock_guard<std::mutex> lock(stats->mutex);
+            info.stopped = stats->stopped;
+            info.histogram = stats->histogram;
+        }
+    }
+}
+
 char const* hc::Perf::getTitle() {
     return ICON_FA_TASKS " Perf";
 }
 
 void hc::Perf::onDraw() {
+    if (_tscHz > 0.0) {
+        ImGui::Text("Clock: steady, %" PRIu64 " ns resolution, counter: TSC at %.3f MHz", _resolutionNs, _tscHz / 1000000.0);
+    }
+    else {
+        ImGui::Text("Clock: steady, %" PRIu64 " ns resolution, counter: nanoseconds", _resolutionNs);
+    }
+
+    ImGui::Text("SIMD:");
+
+    for (auto const& simd : simdNames) {
+        if ((_cpuFeatures & simd.bit) != 0) {
+            ImGui::SameLine();
+            ImGui::Text("%s", simd.name);
+        }
+    }
+
+    ImGui::Separator();
+
+    bool tracing = Trace::enabled();
+
+    if (ImGui::Checkbox("Trace", &tracing)) {
+        Trace::enable(tracing);
+    }
+
+    ImGui::SameLine();
+    ImGui::SliderInt("Last seconds", &_traceSeconds, 0, 60);
+    ImGui::InputText("##tracePath", _tracePath, sizeof(_tracePath));
+    ImGui::SameLine();
+
+    if (ImGui::Button(ICON_FA_FLOPPY_O " Save trace")) {
+        if (Trace::save(_tracePath, _traceSeconds)) {
+            _desktop->info(TAG "Saved trace to \"%s\"", _tracePath);
+        }
+        else {
+            _desktop->error(TAG "Error saving trace to \"%s\": %s", _tracePath, strerror(errno));
+        }
+    }
+
+    ImGui::Separator();
+
     ImGui::Text("       %7.3f (fps) application", _desktop->drawFps());
     ImGui::Text("       %7.3f (fps) game", _desktop->frameFps());
 
+    if (ImGui::Button(ICON_FA_TRASH_O " Reset")) {
+        resetStats();
+    }
+
+    ImGui::SameLine();
+
+    if (ImGui::Button(ICON_FA_CAMERA " Snapshot")) {
+        // Logs the current percentiles so they can be compared later
+        log();
+    }
+
+    ImGui::Text("calls     mean      p50      p95      p99      max (ms)");
+
+    // Copies of the statistics, so they're drawn without holding the locks
+    // that the threads stopping the counters wait on
+    Histogram histogram;
+    ImGuiAl::BufferedSparkline<WindowSize> sparkline;
+
     for (const auto& pair : _counters) {
         Counter const& cnt = pair.second;
+        bool stopped = false;
 
-        uint64_t const nsPerCall = cnt.counter->call_cnt != 0 ? cnt.counter->total / cnt.counter->call_cnt : 0;
-        uint64_t const usPerCall = nsPerCall / 1000;
-        unsigned const ms = usPerCall / 1000;
-        unsigned const us = usPerCall - ms * 1000;
+        if (cnt.stats != nullptr) {
+            std::lock_guard<std::mutex> lock(cnt.stats->mutex);
+            stopped = cnt.stats->stopped;
 
-        ImGui::Text("%6" PRIu64 " %3u.%03u (ms)  %s", cnt.counter->call_cnt, ms, us, cnt.counter->ident);
+            if (stopped) {
+                histogram = cnt.stats->histogram;
+                sparkline = cnt.stats->sparkline;
+            }
+        }
+
+        if (!stopped) {
+            ImGui::Text("%6" PRIu64 "        -        -        -        -        -  %s", cnt.counter->call_cnt, cnt.counter->ident);
+            continue;
+        }
+
+        ImGui::Text(
+            "%6" PRIu64 " %8.3f %8.3f %8.3f %8.3f %8.3f  %s",
+            cnt.counter->call_cnt,
+            histogram.mean() / 1000000.0,
+            histogram.percentile(50.0) / 1000000.0,
+            histogram.percentile(95.0) / 1000000.0,
+            histogram.percentile(99.0) / 1000000.0,
+            histogram.max() / 1000000.0,
+            cnt.counter->ident
+        );
+
+        ImGui::PushID(cnt.counter);
+        sparkline.draw("##sparkline", ImVec2(ImGui::GetContentRegionAvail().x, 32.0f));
+        ImGui::PopID();
     }
 }
 
 void hc::Perf::onCoreUnloaded() {
+    // No other thread stops counters by now, the audio worker is stopped
+    // when the game is unloaded
+    for (auto& slot : _slots) {
+        slot.counter.store(nullptr, std::memory_order_relaxed);
+        slot.stats = nullptr;
+    }
+
+    _slotsUsed = 0;
+
     for (auto const& pair : _counters) {
         Counter const& cnt = pair.second;
+        delete cnt.stats;
 
         if (cnt.mustDelete) {
             free((void*)cnt.counter->ident);
@@ -55,6 +322,7 @@ void hc::Perf::onCoreUnloaded() {
     }
 
     _counters.clear();
+    _generation++;
 }
 
 retro_time_t hc::Perf::getTimeUsec() {
@@ -62,11 +330,16 @@ retro_time_t hc::Perf::getTimeUsec() {
 }
 
 uint64_t hc::Perf::getCpuFeatures() {
-    // TODO actually probe the CPU for features
-    return 0;
+    return _cpuFeatures;
 }
 
 retro_perf_tick_t hc::Perf::getCounter() {
+#ifdef HC_PERF_X86
+    if (_tscHz > 0.0) {
+        return static_cast<retro_perf_tick_t>(__rdtsc());
+    }
+#endif
+
     return static_cast<retro_perf_tick_t>(getTimeNs());
 }
 
@@ -79,25 +352,38 @@ void hc::Perf::register_(retro_perf_counter* counter) {
         counter->call_cnt = 0;
         counter->registered = true;
 
-        Counter cnt = {counter, false};
+        Counter cnt = {counter, addStats(counter), false};
         _counters.insert(std::make_pair(counter->ident, cnt));
     }
 }
 
 void hc::Perf::start(retro_perf_counter* counter) {
-    const retro_perf_tick_t tick = getCounter();
+    Trace::begin(counter->ident);
+    const retro_perf_tick_t tick = getTimeNs();
     counter->start = tick;
 }
 
 void hc::Perf::stop(retro_perf_counter* counter) {
-    const retro_perf_tick_t tick = getCounter();
-    counter->total += tick - counter->start;
-    counter->call_cnt++;
+    stop(counter, findStats(counter));
 }
 
 void hc::Perf::log() {
+    Histogram histogram;
+
     for (const auto& pair : _counters) {
         Counter const& cnt = pair.second;
+        bool stopped = false;
+
+        if (cnt.stats != nullptr) {
+            std::lock_guard<std::mutex> lock(cnt.stats->mutex);
+            stopped = cnt.stats->stopped;
+            histogram = cnt.stats->histogram;
+        }
+
+        if (stopped) {
+            logStats(cnt.counter->ident, histogram);
+            continue;
+        }
 
         uint64_t const nsPerCall = cnt.counter->call_cnt != 0 ? cnt.counter->total / cnt.counter->call_cnt : 0;
         uint64_t const usPerCall = nsPerCall / 1000;
@@ -108,6 +394,89 @@ void hc::Perf::log() {
     }
 }
 
+void hc::Perf::resetStats() {
+    for (auto const& pair : _counters) {
+        Stats* const stats = pair.second.stats;
+
+        if (stats != nullptr) {
+            std::lock_guard<std::mutex> lock(stats->mutex);
+            stats->histogram.reset();
+            stats->sparkline.clear();
+            stats->head = 0;
+        }
+    }
+}
+
+hc::Perf::Stats* hc::Perf::addStats(retro_perf_counter const* const counter) {
+    // Keep the table at most half full so lookups stay short
+    if (_slotsUsed >= SlotCount / 2) {
+        _desktop->warn(TAG "Too many counters, no statistics for \"%s\"", counter->ident);
+        return nullptr;
+    }
+
+    Stats* const stats = new Stats;
+    unsigned slot = slotOf(counter);
+
+    while (_slots[slot].counter.load(std::memory_order_relaxed) != nullptr) {
+        slot = (slot + 1) & (SlotCount - 1);
+    }
+
+    // Publish the statistics before the key that makes them visible to stop
+    _slots[slot].stats = stats;
+    _slots[slot].counter.store(counter, std::memory_order_release);
+    _slotsUsed++;
+    return stats;
+}
+
+hc::Perf::Stats* hc::Perf::findStats(retro_perf_counter const* const counter) const {
+    for (unsigned slot = slotOf(counter);; slot = (slot + 1) & (SlotCount - 1)) {
+        retro_perf_counter const* const key = _slots[slot].counter.load(std::memory_order_acquire);
+
+        if (key == counter) {
+            return _slots[slot].stats;
+        }
+        else if (key == nullptr) {
+            // Not registered
+            return nullptr;
+        }
+    }
+}
+
+unsigned hc::Perf::slotOf(retro_perf_counter const* const counter) {
+    // Fibonacci hashing of the address, the low bits are always zero
+    uint64_t const address = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(counter));
+    return static_cast<unsigned>((address * UINT64_C(0x9e3779b97f4a7c15)) >> 54) & (SlotCount - 1);
+}
+
+void hc::Perf::stop(retro_perf_counter* const counter, Stats* const stats) {
+    const retro_perf_tick_t tick = getTimeNs();
+    uint64_t const elapsed = tick - counter->start;
+    counter->total += elapsed;
+    counter->call_cnt++;
+    Trace::end(counter->ident);
+
+    if (stats != nullptr) {
+        std::lock_guard<std::mutex> lock(stats->mutex);
+        stats->histogram.add(elapsed);
+        stats->sparkline.add(static_cast<float>(elapsed / 1000000.0));
+        stats->window[stats->head++ % WindowSize] = elapsed;
+        stats->stopped = true;
+    }
+}
+
+void hc::Perf::logStats(char const* const ident, Histogram const& histogram) {
+    _desktop->info(
+        TAG "%6" PRIu64 " mean %.3f p50 %.3f p95 %.3f p99 %.3f max %.3f (ms) %s",
+        histogram.count(),
+        histogram.mean() / 1000000.0,
+        histogram.percentile(50.0) / 1000000.0,
+        histogram.percentile(95.0) / 1000000.0,
+        histogram.percentile(99.0) / 1000000.0,
+        histogram.max() / 1000000.0,
+        ident
+    );
+}
+
 int hc::Perf::push(lua_State* const L) {
     auto const self = static_cast<Perf**>(lua_newuserdata(L, sizeof(Perf*)));
     *self = this;
@@ -120,6 +489,10 @@ int hc::Perf::push(lua_State* const L) {
             {"start", l_start},
             {"stop", l_stop},
             {"log", l_log},
+            {"stats", l_stats},
+            {"resetStats", l_resetStats},
+            {"trace", l_trace},
+            {"saveTrace", l_saveTrace},
             {nullptr, nullptr}
         };
 
@@ -131,6 +504,44 @@ int hc::Perf::push(lua_State* const L) {
     return 1;
 }
 
+void hc::Perf::calibrate() {
+    // Smallest step of the clock seen in a number of reads
+    _resolutionNs = UINT64_MAX;
+
+    for (unsigned i = 0; i < 100; i++) {
+        uint64_t const t0 = getTimeNs();
+        uint64_t t1;
+
+        do {
+            t1 = getTimeNs();
+        }
+        while (t1 == t0);
+
+        _resolutionNs = t1 - t0 < _resolutionNs ? t1 - t0 : _resolutionNs;
+    }
+
+    _tscHz = 0.0;
+
+#ifdef HC_PERF_X86
+    if (!_invariantTsc) {
+        return;
+    }
+
+    // Measure the TSC against the monotonic clock for 20 ms
+    uint64_t const t0 = getTimeNs();
+    uint64_t const c0 = __rdtsc();
+    uint64_t t1;
+
+    do {
+        t1 = getTimeNs();
+    }
+    while (t1 - t0 < 20000000);
+
+    uint64_t const c1 = __rdtsc();
+    _tscHz = static_cast<double>(c1 - c0) * 1000000000.0 / static_cast<double>(t1 - t0);
+#endif
+}
+
 hc::Perf* hc::Perf::check(lua_State* const L, int const index) {
     return *static_cast<Perf**>(luaL_checkudata(L, index, "hc::Perf"));
 }
@@ -173,27 +584,116 @@ int hc::Perf::l_register(lua_State* const L) {
     counter->call_cnt = 0;
     counter->registered = true;
 
-    Counter cnt = {counter, true};
+    Counter cnt = {counter, self->addStats(counter), true};
     self->_counters.insert(std::make_pair(std::string(ident, length), cnt));
-    return 0;
+    return pushHandle(L, self, counter, cnt.stats);
 }
 
 int hc::Perf::l_start(lua_State* const L) {
+    auto const self = check(L, 1);
+    self->start(checkCounter(L, 2));
+    return 0;
+}
+
+int hc::Perf::l_stop(lua_State* const L) {
+    auto const self = check(L, 1);
+    self->stop(checkCounter(L, 2));
+    return 0;
+}
+
+int hc::Perf::pushHandle(lua_State* const L, Perf* const self, retro_perf_counter* const counter, Stats* const stats) {
+    auto const handle = static_cast<Handle*>(lua_newuserdata(L, sizeof(Handle)));
+    handle->self = self;
+    handle->counter = counter;
+    handle->stats = stats;
+    handle->generation = self->_generation;
+
+    if (luaL_newmetatable(L, HANDLE_MT)) {
+        static luaL_Reg const methods[] = {
+            {"start", l_handleStart},
+            {"stop", l_handleStop},
+            {"scope", l_handleScope},
+            {"ident", l_handleIdent},
+            {nullptr, nullptr}
+        };
+
+        luaL_newlib(L, methods);
+        lua_setfield(L, -2, "__index");
+
+        // Stops the counter when a to-be-closed variable goes out of scope
+        lua_pushcfunction(L, l_handleStop);
+        lua_setfield(L, -2, "__close");
+    }
+
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+hc::Perf::Handle* hc::Perf::checkHandle(lua_State* const L, int const index) {
+    auto const handle = static_cast<Handle*>(luaL_checkudata(L, index, HANDLE_MT));
+
+    if (handle->generation != handle->self->_generation) {
+        luaL_error(L, "counter was freed when the core was unloaded");
+    }
+
+    return handle;
+}
+
+retro_perf_counter* hc::Perf::checkCounter(lua_State* const L, int const index) {
+    auto const handle = static_cast<Handle*>(luaL_testudata(L, index, HANDLE_MT));
+
+    if (handle != nullptr) {
+        return checkHandle(L, index)->counter;
+    }
+
+    // Slow path, kept for scripts that still use the counter names
     auto const self = check(L, 1);
     size_t length = 0;
-    char const* const ident = luaL_checklstring(L, 2, &length);
+    char const* const ident = luaL_checklstring(L, index, &length);
 
     auto const found = self->_counters.find(std::string(ident, length));
 
     if (found == self->_counters.end()) {
-        return luaL_error(L, "counter \"%s\" does not exist", ident);
+        luaL_error(L, "counter \"%s\" does not exist", ident);
+        return nullptr;
     }
 
-    self->start(found->second.counter);
+    return found->second.counter;
+}
+
+int hc::Perf::l_handleStart(lua_State* const L) {
+    auto const handle = checkHandle(L, 1);
+    handle->self->start(handle->counter);
     return 0;
 }
 
-int hc::Perf::l_stop(lua_State* const L) {
+int hc::Perf::l_handleStop(lua_State* const L) {
+    auto const handle = checkHandle(L, 1);
+    handle->self->stop(handle->counter, handle->stats);
+    return 0;
+}
+
+int hc::Perf::l_handleScope(lua_State* const L) {
+    // local _ <close> = counter:scope()
+    auto const handle = checkHandle(L, 1);
+    handle->self->start(handle->counter);
+    lua_settop(L, 1);
+    return 1;
+}
+
+int hc::Perf::l_handleIdent(lua_State* const L) {
+    auto const handle = checkHandle(L, 1);
+    lua_pushstring(L, handle->counter->ident);
+    return 1;
+}
+
+int hc::Perf::l_log(lua_State* const L) {
+    auto const self = check(L, 1);
+    self->log();
+    return 0;
+}
+
+int hc::Perf::l_stats(lua_State* const L) {
     auto const self = check(L, 1);
     size_t length = 0;
     char const* const ident = luaL_checklstring(L, 2, &length);
@@ -204,12 +704,85 @@ int hc::Perf::l_stop(lua_State* const L) {
         return luaL_error(L, "counter \"%s\" does not exist", ident);
     }
 
-    self->stop(found->second.counter);
-    return 0;
+    // Copy the statistics so no Lua errors are raised with the lock held
+    Histogram histogram;
+    uint64_t window[WindowSize];
+    unsigned head = 0;
+
+    bool stopped = false;
+    Stats* const stats = found->second.stats;
+
+    if (stats != nullptr) {
+        std::lock_guard<std::mutex> lock(stats->mutex);
+        stopped = stats->stopped;
+        histogram = stats->histogram;
+        head = stats->head;
+        memcpy(window, stats->window, sizeof(window));
+    }
+
+    if (!stopped) {
+        // Never stopped
+        lua_pushnil(L);
+        return 1;
+    }
+
+    // All times are in nanoseconds
+    lua_createtable(L, 0, 8);
+
+    lua_pushinteger(L, static_cast<lua_Integer>(histogram.count()));
+    lua_setfield(L, -2, "count");
+
+    lua_pushnumber(L, histogram.mean());
+    lua_setfield(L, -2, "mean");
+
+    lua_pushinteger(L, static_cast<lua_Integer>(histogram.min()));
+    lua_setfield(L, -2, "min");
+
+    lua_pushinteger(L, static_cast<lua_Integer>(histogram.percentile(50.0)));
+    lua_setfield(L, -2, "p50");
+
+    lua_pushinteger(L, static_cast<lua_Integer>(histogram.percentile(95.0)));
+    lua_setfield(L, -2, "p95");
+
+    lua_pushinteger(L, static_cast<lua_Integer>(histogram.percentile(99.0)));
+    lua_setfield(L, -2, "p99");
+
+    lua_pushinteger(L, static_cast<lua_Integer>(histogram.max()));
+    lua_setfield(L, -2, "max");
+
+    // Recent samples, oldest first
+    unsigned const count = head < WindowSize ? head : static_cast<unsigned>(WindowSize);
+    lua_createtable(L, static_cast<int>(count), 0);
+
+    for (unsigned i = 0; i < count; i++) {
+        lua_pushinteger(L, static_cast<lua_Integer>(window[(head - count + i) % WindowSize]));
+        lua_rawseti(L, -2, i + 1);
+    }
+
+    lua_setfield(L, -2, "window");
+    return 1;
 }
 
-int hc::Perf::l_log(lua_State* const L) {
+int hc::Perf::l_resetStats(lua_State* const L) {
     auto const self = check(L, 1);
-    self->log();
+    self->resetStats();
+    return 0;
+}
+
+int hc::Perf::l_trace(lua_State* const L) {
+    check(L, 1);
+    Trace::enable(lua_toboolean(L, 2) != 0);
+    return 0;
+}
+
+int hc::Perf::l_saveTrace(lua_State* const L) {
+    check(L, 1);
+    char const* const path = luaL_checkstring(L, 2);
+    lua_Number const seconds = luaL_optnumber(L, 3, 0.0);
+
+    if (!Trace::save(path, seconds)) {
+        return luaL_error(L, "error saving trace to \"%s\": %s", path, strerror(errno));
+    }
+
     return 0;
 }
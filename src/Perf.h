@@ -2,25 +2,44 @@
 
 #include "Desktop.h"
 #include "Scriptable.h"
+#include "Histogram.h"
 
 #include <lrcpp/Components.h>
+#include <imguial_sparkline.h>
 
 #include <stdint.h>
 #include <string>
 #include <unordered_map>
+#include <vector>
+#include <atomic>
+#include <mutex>
 
 namespace hc
 {
     class Perf : public View, public Scriptable, public lrcpp::Perf {
     public:
-        Perf(Desktop* desktop) : View(desktop) {}
+        Perf(Desktop* desktop);
         virtual ~Perf() {}
 
         void init();
 
+        // Monotonic clock, not affected by changes to the wall clock time.
+        // Counters started and stopped via Perf are always in nanoseconds
         static uint64_t getTimeUs();
         static uint64_t getTimeNs();
 
+        struct CounterInfo {
+            char const* ident;
+            uint64_t calls;
+            uint64_t total;
+            // False if the counter was never stopped
+            bool stopped;
+            Histogram histogram;
+        };
+
+        // Must be called with the core mutex held
+        void getCounters(std::vector<CounterInfo>* const counters) const;
+
         static Perf* check(lua_State* const L, int const index);
 
         // hc::View
@@ -47,12 +66,99 @@ namespace hc
         static int l_start(lua_State* const L);
         static int l_stop(lua_State* const L);
         static int l_log(lua_State* const L);
+        static int l_stats(lua_State* const L);
+        static int l_resetStats(lua_State* const L);
+        static int l_trace(lua_State* const L);
+        static int l_saveTrace(lua_State* const L);
+
+        // Counters registered from Lua are userdata handles, so starting and
+        // stopping them doesn't need to look them up, either by name or for
+        // their statistics
+        struct Stats;
+
+        struct Handle {
+            Perf* self;
+            retro_perf_counter* counter;
+            Stats* stats;
+            unsigned generation;
+        };
+
+        static int pushHandle(lua_State* const L, Perf* const self, retro_perf_counter* const counter, Stats* const stats);
+        static Handle* checkHandle(lua_State* const L, int const index);
+        static retro_perf_counter* checkCounter(lua_State* const L, int const index);
+
+        static int l_handleStart(lua_State* const L);
+        static int l_handleStop(lua_State* const L);
+        static int l_handleScope(lua_State* const L);
+        static int l_handleIdent(lua_State* const L);
+
+        void calibrate();
+
+        enum {
+            // Number of recent samples kept for each counter
+            WindowSize = 256,
+            // Size of the table that finds the statistics of the counters
+            // stopped by the core, must be a power of two
+            SlotCount = 1024
+        };
+
+        // Distribution of the times of a counter since the last reset, and
+        // its most recent samples. Counters can be stopped by threads that
+        // don't hold the core mutex, i.e. the audio worker, so each one has
+        // its own mutex
+        struct Stats {
+            Stats() : head(0), stopped(false) {}
+
+            std::mutex mutex;
+            Histogram histogram;
+            ImGuiAl::BufferedSparkline<WindowSize> sparkline;
+            uint64_t window[WindowSize];
+            unsigned head;
+            bool stopped;
+        };
 
         struct Counter {
             retro_perf_counter* const counter;
+            Stats* const stats;
             bool const mustDelete;
         };
 
+        // Slots are only added with the core mutex held, and only cleared
+        // when the core is unloaded, so stop can look them up without locks
+        struct Slot {
+            std::atomic<retro_perf_counter const*> counter;
+            Stats* stats;
+        };
+
+        Stats* addStats(retro_perf_counter const* const counter);
+        Stats* findStats(retro_perf_counter const* const counter) const;
+        static unsigned slotOf(retro_perf_counter const* const counter);
+
+        void stop(retro_perf_counter* const counter, Stats* const stats);
+        void resetStats();
+        void logStats(char const* const ident, Histogram const& histogram);
+
         std::unordered_map<std::string, Counter> _counters;
+
+        // Incremented when the counters are freed, invalidates the handles
+        // still held by Lua
+        unsigned _generation;
+
+        // Allocated when each counter is registered
+        Slot _slots[SlotCount];
+        unsigned _slotsUsed;
+
+        // RETRO_SIMD_* bits, probed once in init
+        uint64_t _cpuFeatures;
+
+        // getCounter returns TSC ticks when the TSC is invariant, otherwise
+        // it returns nanoseconds
+        double _tscHz;
+        bool _invariantTsc;
+        uint64_t _resolutionNs;
+
+        // Chrome trace export, see Trace.h
+        char _tracePath[256];
+        int _traceSeconds;
     };
 }
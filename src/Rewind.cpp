@@ -0,0 +1,470 @@
+#include "Rewind.h"
+#include "Video.h"
+#include "Perf.h"
+#include "Pacer.h"
+#include "Lz.h"
+#include "Trace.h"
+
+#include <lrcpp/Frontend.h>
+
+#include <IconsFontAwesome4.h>
+
+#include <inttypes.h>
+#include <string.h>
+
+#ifdef _USE_SSE2
+#include <emmintrin.h>
+#endif
+
+extern "C" {
+    #include "lauxlib.h"
+}
+
+#define TAG "[RWD] "
+
+// dest = a ^ b
+static void xorBlocks(uint8_t* const dest, uint8_t const* const a, uint8_t const* const b, size_t const size) {
+    size_t i = 0;
+
+#ifdef _USE_SSE2
+    for (; i + 16 <= size; i += 16) {
+        __m128i const x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(a + i));
+        __m128i const y = _mm_loadu_si128(reinterpret_cast<__m128i const*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_xor_si128(x, y));
+    }
+#endif
+
+    for (; i < size; i++) {
+        dest[i] = a[i] ^ b[i];
+    }
+}
+
+hc::Rewind::Rewind(Desktop* desktop)
+    : View(desktop)
+    , _video(nullptr)
+    , _perf(nullptr)
+    , _enabled(false)
+    , _interval(4)
+    , _budget(64)
+    , _counter(0)
+    , _stateSize(0)
+    , _hasPrevious(false)
+    , _head(0)
+    , _used(0)
+    , _busy(false)
+    , _quit(false)
+    , _skipped(0)
+    , _compressNs(0)
+    , _rawBytes(0)
+    , _compressedBytes(0)
+{}
+
+void hc::Rewind::init(Video* const video, Perf* const perf) {
+    _video = video;
+    _perf = perf;
+}
+
+bool hc::Rewind::rewind(unsigned const steps) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle.wait(lock, [this]() { return !_busy; });
+
+    if (!_hasPrevious || _entries.empty()) {
+        return false;
+    }
+
+    // Walk the chain back from the last state saved
+    for (unsigned i = 0; i < steps && !_entries.empty(); i++) {
+        Entry const entry = _entries.back();
+
+        if (!Lz::decompress(_ring.data() + entry.offset, entry.size, _delta.data(), _stateSize)) {
+            _desktop->error(TAG "Corrupted rewind entry, discarding the rewind history");
+            reset(_stateSize);
+            return false;
+        }
+
+        xorBlocks(_previous.data(), _previous.data(), _delta.data(), _stateSize);
+
+        _entries.pop_back();
+        _head = entry.offset;
+        _used -= entry.size;
+    }
+
+    lock.unlock();
+    _counter = 0;
+
+    if (!lrcpp::Frontend::getInstance().unserialize(_previous.data(), _stateSize)) {
+        _desktop->error(TAG "Error restoring the rewound state");
+        return false;
+    }
+
+    return true;
+}
+
+hc::Rewind* hc::Rewind::check(lua_State* const L, int const index) {
+    return *static_cast<Rewind**>(luaL_checkudata(L, index, "hc::Rewind"));
+}
+
+char const* hc::Rewind::getTitle() {
+    return ICON_FA_BACKWARD " Rewind";
+}
+
+void hc::Rewind::onCoreLoaded() {
+    // Perf unregisters all counters when a core is unloaded
+    _savePerf.ident = "hc::rewind";
+    _perf->register_(&_savePerf);
+}
+
+void hc::Rewind::onGameLoaded() {
+    _counter = 0;
+    startWorker();
+}
+
+void hc::Rewind::onFrame() {
+    if (!_enabled || ++_counter < _interval) {
+        return;
+    }
+
+    _counter = 0;
+
+    auto& frontend = lrcpp::Frontend::getInstance();
+    size_t size = 0;
+
+    if (!frontend.serializeSize(&size) || size == 0) {
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if (_busy) {
+            // The worker is still compressing the previous state
+            _skipped++;
+            return;
+        }
+
+        if (size != _stateSize || _ring.empty()) {
+            reset(size);
+        }
+    }
+
+    _perf->start(&_savePerf);
+    bool const ok = frontend.serialize(_job.data(), size);
+    _perf->stop(&_savePerf);
+
+    if (!ok) {
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _busy = true;
+    }
+
+    _gate.notify_one();
+}
+
+void hc::Rewind::onDraw() {
+    bool enabled = _enabled;
+
+    if (ImGui::Checkbox("Enabled", &enabled)) {
+        setEnabled(enabled);
+    }
+
+    ImGui::SliderInt("Interval (frames)", &_interval, 1, 60);
+
+    int budget = _budget;
+
+    if (ImGui::SliderInt("Budget (MiB)", &budget, 8, 1024) && budget != _budget) {
+        setBudget(budget);
+    }
+
+    size_t entries = 0, used = 0;
+    uint64_t skipped = 0, compressNs = 0, raw = 0, compressed = 0;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        entries = _entries.size();
+        used = _used;
+        skipped = _skipped;
+        compressNs = _compressNs;
+        raw = _rawBytes;
+        compressed = _compressedBytes;
+    }
+
+    double const fps = _video->getCoreFps();
+    double const seconds = fps > 0.0 ? entries * _interval / fps : 0.0;
+
+    ImGui::Text("%zu states, %.1f seconds, %.2f of %d MiB", entries, seconds, used / 1048576.0, _budget);
+
+    ImGui::Text(
+        "State %zu bytes, ratio %.1f:1, compression %.3f ms, %" PRIu64 " skipped",
+        _stateSize, compressed != 0 ? static_cast<double>(raw) / compressed : 0.0, compressNs / 1000000.0, skipped
+    );
+
+    // Keeps rewinding while the button is held down
+    ImGui::Button(ICON_FA_BACKWARD " Hold to rewind");
+
+    if (ImGui::IsItemActive() && _enabled) {
+        rewind(1);
+    }
+}
+
+void hc::Rewind::onGameUnloaded() {
+    stopWorker();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    release();
+}
+
+int hc::Rewind::push(lua_State* const L) {
+    auto const self = static_cast<Rewind**>(lua_newuserdata(L, sizeof(Rewind*)));
+    *self = this;
+
+    if (luaL_newmetatable(L, "hc::Rewind")) {
+        static luaL_Reg const methods[] = {
+            {"enable", l_enable},
+            {"setInterval", l_setInterval},
+            {"setBudget", l_setBudget},
+            {"rewind", l_rewind},
+            {"stats", l_stats},
+            {nullptr, nullptr}
+        };
+
+        luaL_newlib(L, methods);
+        lua_setfield(L, -2, "__index");
+    }
+
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+void hc::Rewind::setEnabled(bool const enabled) {
+    _enabled = enabled;
+    _counter = 0;
+
+    if (!enabled) {
+        // Give the memory back
+        std::unique_lock<std::mutex> lock(_mutex);
+        _idle.wait(lock, [this]() { return !_busy; });
+        release();
+    }
+}
+
+void hc::Rewind::setBudget(int const megabytes) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle.wait(lock, [this]() { return !_busy; });
+
+    _budget = megabytes;
+
+    // The ring is reallocated with the new budget on the next state save
+    release();
+}
+
+void hc::Rewind::reset(size_t const stateSize) {
+    _stateSize = stateSize;
+    _job.resize(stateSize);
+    _previous.resize(stateSize);
+    _delta.resize(stateSize);
+    _compressed.resize(Lz::bound(stateSize));
+    _hasPrevious = false;
+
+    _ring.resize(static_cast<size_t>(_budget) * 1024 * 1024);
+    _entries.clear();
+    _head = _used = 0;
+
+    _skipped = _compressNs = _rawBytes = _compressedBytes = 0;
+}
+
+void hc::Rewind::release() {
+    // Don't go through reset, it would allocate the ring just to free it
+    _stateSize = 0;
+    _hasPrevious = false;
+    _entries.clear();
+    _head = _used = 0;
+    _skipped = _compressNs = _rawBytes = _compressedBytes = 0;
+
+    std::vector<uint8_t>().swap(_job);
+    std::vector<uint8_t>().swap(_previous);
+    std::vector<uint8_t>().swap(_delta);
+    std::vector<uint8_t>().swap(_compressed);
+    std::vector<uint8_t>().swap(_ring);
+}
+
+void hc::Rewind::push(size_t const size) {
+    size_t const capacity = _ring.size();
+
+    if (size > capacity) {
+        // Doesn't fit even in an empty ring, the chain is broken
+        _entries.clear();
+        _head = _used = 0;
+        return;
+    }
+
+    if (_head + size > capacity) {
+        // Wrap around, the entries at the end of the ring are the oldest
+        while (!_entries.empty() && _entries.front().offset >= _head) {
+            _used -= _entries.front().size;
+            _entries.pop_front();
+        }
+
+        _head = 0;
+    }
+
+    while (!_entries.empty()) {
+        Entry const& oldest = _entries.front();
+
+        if (oldest.offset >= _head + size || oldest.offset + oldest.size <= _head) {
+            break;
+        }
+
+        _used -= oldest.size;
+        _entries.pop_front();
+    }
+
+    memcpy(_ring.data() + _head, _compressed.data(), size);
+
+    Entry const entry = {_head, size};
+    _entries.push_back(entry);
+    _head += size;
+    _used += size;
+}
+
+void hc::Rewind::worker() {
+    Trace::setThreadName("rewind");
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _gate.wait(lock, [this]() { return _busy || _quit; });
+
+            if (_quit) {
+                return;
+            }
+        }
+
+        process();
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _busy = false;
+        }
+
+        _idle.notify_all();
+    }
+}
+
+void hc::Rewind::process() {
+    Trace::Scope scope("Rewind::process");
+
+    if (_hasPrevious) {
+        uint64_t const start = Pacer::now();
+
+        // _previous ^ _delta gives the state before _job when rewinding
+        xorBlocks(_delta.data(), _job.data(), _previous.data(), _stateSize);
+        size_t const size = Lz::compress(_delta.data(), _stateSize, _compressed.data(), _compressed.size());
+
+        uint64_t const elapsed = Pacer::now() - start;
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        push(size);
+
+        _compressNs = elapsed;
+        _rawBytes += _stateSize;
+        _compressedBytes += size;
+    }
+
+    // The emulation thread doesn't touch _job while the worker is busy
+    _job.swap(_previous);
+    _hasPrevious = true;
+}
+
+void hc::Rewind::startWorker() {
+    _busy = false;
+    _quit = false;
+    _workerThread = std::thread(&Rewind::worker, this);
+}
+
+void hc::Rewind::stopWorker() {
+    if (!_workerThread.joinable()) {
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+
+    _gate.notify_one();
+    _workerThread.join();
+
+    // A state may have been queued but not processed
+    _busy = false;
+}
+
+int hc::Rewind::l_enable(lua_State* const L) {
+    auto const self = check(L, 1);
+    self->setEnabled(lua_toboolean(L, 2) != 0);
+    return 0;
+}
+
+int hc::Rewind::l_setInterval(lua_State* const L) {
+    auto const self = check(L, 1);
+    lua_Integer const interval = luaL_checkinteger(L, 2);
+
+    if (interval < 1) {
+        return luaL_error(L, "invalid interval %I", interval);
+    }
+
+    self->_interval = static_cast<int>(interval);
+    return 0;
+}
+
+int hc::Rewind::l_setBudget(lua_State* const L) {
+    auto const self = check(L, 1);
+    lua_Integer const megabytes = luaL_checkinteger(L, 2);
+
+    if (megabytes < 1) {
+        return luaL_error(L, "invalid budget %I", megabytes);
+    }
+
+    self->setBudget(static_cast<int>(megabytes));
+    return 0;
+}
+
+int hc::Rewind::l_rewind(lua_State* const L) {
+    auto const self = check(L, 1);
+    lua_Integer const steps = luaL_optinteger(L, 2, 1);
+
+    lua_pushboolean(L, steps > 0 && self->rewind(static_cast<unsigned>(steps)));
+    return 1;
+}
+
+int hc::Rewind::l_stats(lua_State* const L) {
+    auto const self = check(L, 1);
+    std::unique_lock<std::mutex> lock(self->_mutex);
+
+    lua_createtable(L, 0, 7);
+
+    lua_pushboolean(L, self->_enabled);
+    lua_setfield(L, -2, "enabled");
+
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_entries.size()));
+    lua_setfield(L, -2, "states");
+
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_used));
+    lua_setfield(L, -2, "used");
+
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_ring.size()));
+    lua_setfield(L, -2, "capacity");
+
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_stateSize));
+    lua_setfield(L, -2, "stateSize");
+
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_compressNs));
+    lua_setfield(L, -2, "compressNs");
+
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_skipped));
+    lua_setfield(L, -2, "skipped");
+
+    return 1;
+}
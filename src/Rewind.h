@@ -0,0 +1,106 @@
+#pragma once
+
+#include "Desktop.h"
+#include "Scriptable.h"
+
+#include <lrcpp/Components.h>
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace hc {
+    // Saves the state every few frames and keeps the XOR deltas between
+    // consecutive states, compressed, in a ring with a fixed memory budget.
+    // Compression happens in a worker thread so that the emulation thread
+    // only pays for serializing the state.
+    class Rewind : public View, public Scriptable {
+    public:
+        Rewind(Desktop* desktop);
+        virtual ~Rewind() {}
+
+        void init(Video* const video, Perf* const perf);
+
+        // Restores the state from steps snapshots ago, must be called with
+        // the core mutex held
+        bool rewind(unsigned const steps);
+
+        static Rewind* check(lua_State* const L, int const index);
+
+        // hc::View
+        virtual char const* getTitle() override;
+        virtual void onCoreLoaded() override;
+        virtual void onGameLoaded() override;
+        virtual void onFrame() override;
+        virtual void onDraw() override;
+        virtual void onGameUnloaded() override;
+
+        // hc::Scriptable
+        virtual int push(lua_State* const L) override;
+
+    protected:
+        // A compressed delta in the ring
+        struct Entry {
+            size_t offset;
+            size_t size;
+        };
+
+        void setEnabled(bool const enabled);
+        void setBudget(int const megabytes);
+
+        // Must be called with _mutex held and the worker idle
+        void reset(size_t const stateSize);
+        void release();
+        void push(size_t const size);
+
+        void worker();
+        void process();
+        void startWorker();
+        void stopWorker();
+
+        static int l_enable(lua_State* const L);
+        static int l_setInterval(lua_State* const L);
+        static int l_setBudget(lua_State* const L);
+        static int l_rewind(lua_State* const L);
+        static int l_stats(lua_State* const L);
+
+        Video* _video;
+        Perf* _perf;
+        retro_perf_counter _savePerf;
+
+        bool _enabled;
+        int _interval;
+        int _budget;
+        int _counter;
+
+        // State buffers, _job is written by the emulation thread when the
+        // worker is idle, the others belong to the worker
+        size_t _stateSize;
+        std::vector<uint8_t> _job;
+        std::vector<uint8_t> _previous;
+        std::vector<uint8_t> _delta;
+        std::vector<uint8_t> _compressed;
+        bool _hasPrevious;
+
+        // Oldest entries are evicted when there's no room for a new one
+        std::vector<uint8_t> _ring;
+        std::deque<Entry> _entries;
+        size_t _head;
+        size_t _used;
+
+        std::thread _workerThread;
+        std::mutex _mutex;
+        std::condition_variable _gate;
+        std::condition_variable _idle;
+        bool _busy;
+        bool _quit;
+
+        uint64_t _skipped;
+        uint64_t _compressNs;
+        uint64_t _rawBytes;
+        uint64_t _compressedBytes;
+    };
+}
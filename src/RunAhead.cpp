@@ -0,0 +1,298 @@
+#include "RunAhead.h"
+#include "Config.h"
+#include "Video.h"
+#include "Audio.h"
+#include "Perf.h"
+#include "Pacer.h"
+
+#include <lrcpp/Frontend.h>
+
+#include <IconsFontAwesome4.h>
+
+#include <string.h>
+
+extern "C" {
+    #include "lauxlib.h"
+}
+
+#define TAG "[RAH] "
+
+hc::RunAhead::RunAhead(Desktop* desktop)
+    : View(desktop)
+    , _config(nullptr)
+    , _video(nullptr)
+    , _audio(nullptr)
+    , _perf(nullptr)
+    , _frames(0)
+    , _verified(false)
+    , _framesRun(0)
+    , _slowTime(0)
+    , _slowFrames(0)
+    , _lastCost(0.0)
+{}
+
+void hc::RunAhead::init(Config* const config, Video* const video, Audio* const audio, Perf* const perf) {
+    _config = config;
+    _video = video;
+    _audio = audio;
+    _perf = perf;
+}
+
+bool hc::RunAhead::run() {
+    auto& frontend = lrcpp::Frontend::getInstance();
+
+    if (!active()) {
+        return frontend.run();
+    }
+
+    uint64_t const start = Pacer::now();
+    _framesRun++;
+
+    // Run the real frame, its audio is played but its video is replaced by
+    // the last frame ahead. Until the state has been saved and verified it's
+    // shown, so no frames are lost if the core can't run ahead, i.e. while
+    // a core that must initialize can't serialize yet
+    _video->setDiscard(_verified);
+    bool const ok = frontend.run();
+
+    size_t size = 0;
+    bool saved = frontend.serializeSize(&size) && size != 0;
+
+    if (saved) {
+        if (_state.size() < size) {
+            _state.resize(size);
+        }
+
+        _perf->start(&_serializePerf);
+        saved = frontend.serialize(_state.data(), size);
+        _perf->stop(&_serializePerf);
+    }
+
+    if (!saved) {
+        _video->setDiscard(false);
+
+        if ((_config->getSerializationQuirks() & RETRO_SERIALIZATION_QUIRK_MUST_INITIALIZE) == 0 ||
+            _framesRun > InitializeFrames) {
+
+            disable("the core could not save the state");
+        }
+
+        return ok;
+    }
+
+    _audio->setDiscard(true);
+
+    if (!_verified && !verify(size)) {
+        _audio->setDiscard(false);
+        _video->setDiscard(false);
+        return ok;
+    }
+
+    // Only the last frame ahead is shown
+    for (unsigned i = 1; i <= _frames; i++) {
+        _video->setDiscard(i != _frames);
+        frontend.run();
+    }
+
+    _audio->setDiscard(false);
+    _video->setDiscard(false);
+
+    _perf->start(&_unserializePerf);
+    bool const restored = frontend.unserialize(_state.data(), size);
+    _perf->stop(&_unserializePerf);
+
+    if (!restored) {
+        // The core is now _frames frames ahead, there's no way back
+        disable("the core could not restore the state");
+        return ok;
+    }
+
+    // Disable if run-ahead takes more than the frame time on average
+    uint64_t const elapsed = Pacer::now() - start;
+    double const fps = _video->getCoreFps();
+
+    _slowTime += elapsed;
+
+    if (++_slowFrames == SlowWindow) {
+        double const budget = 1000000000.0 / (fps > 0.0 ? fps : 60.0);
+        _lastCost = static_cast<double>(_slowTime) / SlowWindow / budget;
+
+        _slowTime = 0;
+        _slowFrames = 0;
+
+        if (_lastCost > 1.0) {
+            disable("the core is too slow to run ahead");
+        }
+    }
+
+    return ok;
+}
+
+void hc::RunAhead::setFrames(unsigned const frames) {
+    _frames = frames < MaxFrames ? frames : static_cast<unsigned>(MaxFrames);
+
+    // Give it another chance
+    _reason.clear();
+    _verified = false;
+    _slowTime = 0;
+    _slowFrames = 0;
+    _lastCost = 0.0;
+
+    if (_frames == 0) {
+        std::vector<uint8_t>().swap(_state);
+        std::vector<uint8_t>().swap(_check);
+    }
+}
+
+hc::RunAhead* hc::RunAhead::check(lua_State* const L, int const index) {
+    return *static_cast<RunAhead**>(luaL_checkudata(L, index, "hc::RunAhead"));
+}
+
+char const* hc::RunAhead::getTitle() {
+    return ICON_FA_FAST_FORWARD " Run-Ahead";
+}
+
+void hc::RunAhead::onCoreLoaded() {
+    // Perf unregisters all counters when a core is unloaded
+    _serializePerf.ident = "hc::runahead::serialize";
+    _perf->register_(&_serializePerf);
+
+    _unserializePerf.ident = "hc::runahead::unserialize";
+    _perf->register_(&_unserializePerf);
+}
+
+void hc::RunAhead::onGameLoaded() {
+    setFrames(_frames);
+    _framesRun = 0;
+
+    if ((_config->getSerializationQuirks() & RETRO_SERIALIZATION_QUIRK_INCOMPLETE) != 0) {
+        disable("the core doesn't save the complete state");
+    }
+}
+
+void hc::RunAhead::onDraw() {
+    int frames = static_cast<int>(_frames);
+
+    if (ImGui::SliderInt("Frames", &frames, 0, MaxFrames)) {
+        setFrames(static_cast<unsigned>(frames));
+    }
+
+    if (_frames == 0) {
+        ImGui::Text("Disabled");
+    }
+    else if (!_reason.empty()) {
+        ImGui::Text("Disabled: %s", _reason.c_str());
+
+        if (ImGui::Button(ICON_FA_REFRESH " Retry")) {
+            setFrames(_frames);
+        }
+    }
+    else {
+        uint64_t const saves = _serializePerf.call_cnt != 0 ? _serializePerf.call_cnt : 1;
+        uint64_t const loads = _unserializePerf.call_cnt != 0 ? _unserializePerf.call_cnt : 1;
+
+        ImGui::Text(
+            "Serialize %.3f ms, unserialize %.3f ms, %.0f%% of the frame time",
+            _serializePerf.total / saves / 1000000.0,
+            _unserializePerf.total / loads / 1000000.0,
+            _lastCost * 100.0
+        );
+    }
+}
+
+void hc::RunAhead::onGameUnloaded() {
+    std::vector<uint8_t>().swap(_state);
+    std::vector<uint8_t>().swap(_check);
+}
+
+int hc::RunAhead::push(lua_State* const L) {
+    auto const self = static_cast<RunAhead**>(lua_newuserdata(L, sizeof(RunAhead*)));
+    *self = this;
+
+    if (luaL_newmetatable(L, "hc::RunAhead")) {
+        static luaL_Reg const methods[] = {
+            {"setFrames", l_setFrames},
+            {"getFrames", l_getFrames},
+            {"status", l_status},
+            {nullptr, nullptr}
+        };
+
+        luaL_newlib(L, methods);
+        lua_setfield(L, -2, "__index");
+    }
+
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+void hc::RunAhead::disable(char const* const reason) {
+    _reason = reason;
+    _desktop->warn(TAG "Run-ahead disabled: %s", reason);
+}
+
+bool hc::RunAhead::verify(size_t const size) {
+    // Run the same frame twice from the saved state, the states after them
+    // must be the same for run-ahead to show the correct frames
+    auto& frontend = lrcpp::Frontend::getInstance();
+    _video->setDiscard(true);
+
+    if (_check.size() < size * 2) {
+        _check.resize(size * 2);
+    }
+
+    uint8_t* const first = _check.data();
+    uint8_t* const second = first + size;
+
+    bool const ok = frontend.run() && frontend.serialize(first, size) &&
+                    frontend.unserialize(_state.data(), size) &&
+                    frontend.run() && frontend.serialize(second, size) &&
+                    frontend.unserialize(_state.data(), size);
+
+    if (!ok) {
+        frontend.unserialize(_state.data(), size);
+        disable("the core could not save or restore the state");
+        return false;
+    }
+
+    if (memcmp(first, second, size) != 0) {
+        disable("the core is not deterministic");
+        return false;
+    }
+
+    _verified = true;
+    _desktop->info(TAG "The core is deterministic, running %u frames ahead", _frames);
+    return true;
+}
+
+int hc::RunAhead::l_setFrames(lua_State* const L) {
+    auto const self = check(L, 1);
+    lua_Integer const frames = luaL_checkinteger(L, 2);
+
+    if (frames < 0 || frames > MaxFrames) {
+        return luaL_error(L, "invalid number of frames %I", frames);
+    }
+
+    self->setFrames(static_cast<unsigned>(frames));
+    return 0;
+}
+
+int hc::RunAhead::l_getFrames(lua_State* const L) {
+    auto const self = check(L, 1);
+    lua_pushinteger(L, self->_frames);
+    return 1;
+}
+
+int hc::RunAhead::l_status(lua_State* const L) {
+    auto const self = check(L, 1);
+
+    lua_pushboolean(L, self->active());
+
+    if (self->_reason.empty()) {
+        lua_pushnil(L);
+    }
+    else {
+        lua_pushstring(L, self->_reason.c_str());
+    }
+
+    return 2;
+}
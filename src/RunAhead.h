@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Desktop.h"
+#include "Scriptable.h"
+
+#include <lrcpp/Components.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace hc {
+    class Config;
+    class Video;
+    class Audio;
+
+    // Hides the core's internal lag by running some frames ahead and showing
+    // the last one, and then restoring the state from before the hidden
+    // frames. Disables itself when the core can't do it fast enough or in a
+    // deterministic way.
+    class RunAhead : public View, public Scriptable {
+    public:
+        RunAhead(Desktop* desktop);
+        virtual ~RunAhead() {}
+
+        void init(Config* const config, Video* const video, Audio* const audio, Perf* const perf);
+
+        // Runs one frame of the core, with run-ahead if it's enabled. Must be
+        // called from the emulation thread with the core mutex held
+        bool run();
+
+        void setFrames(unsigned const frames);
+        unsigned frames() const { return _frames; }
+        bool active() const { return _frames != 0 && _reason.empty(); }
+
+        static RunAhead* check(lua_State* const L, int const index);
+
+        // hc::View
+        virtual char const* getTitle() override;
+        virtual void onCoreLoaded() override;
+        virtual void onGameLoaded() override;
+        virtual void onDraw() override;
+        virtual void onGameUnloaded() override;
+
+        // hc::Scriptable
+        virtual int push(lua_State* const L) override;
+
+    protected:
+        enum {
+            // Maximum number of frames to run ahead
+            MaxFrames = 8,
+            // Frames averaged before deciding that run-ahead is too slow
+            SlowWindow = 120,
+            // Frames to wait for cores that can't serialize right after
+            // loading a game
+            InitializeFrames = 60
+        };
+
+        void disable(char const* const reason);
+        bool verify(size_t const size);
+
+        static int l_setFrames(lua_State* const L);
+        static int l_getFrames(lua_State* const L);
+        static int l_status(lua_State* const L);
+
+        Config* _config;
+        Video* _video;
+        Audio* _audio;
+        Perf* _perf;
+
+        retro_perf_counter _serializePerf;
+        retro_perf_counter _unserializePerf;
+
+        unsigned _frames;
+        std::string _reason;
+
+        // Allocated on the first frame and reused until the game is unloaded
+        std::vector<uint8_t> _state;
+        std::vector<uint8_t> _check;
+
+        bool _verified;
+        unsigned _framesRun;
+        uint64_t _slowTime;
+        unsigned _slowFrames;
+        double _lastCost;
+    };
+}
@@ -0,0 +1,526 @@
+#include "Savestates.h"
+#include "Config.h"
+#include "Perf.h"
+#include "Pacer.h"
+#include "MappedFile.h"
+#include "Lz.h"
+#include "Trace.h"
+
+#include <lrcpp/Frontend.h>
+
+#include <IconsFontAwesome4.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+extern "C" {
+    #include "lauxlib.h"
+}
+
+#define TAG "[SAV] "
+
+/*
+Savestate files have a 40-byte header followed by the state compressed with
+Lz, all numbers are little endian:
+
+* "HCSS"
+* Version (32 bits)
+* Hash of the core name and version (64 bits)
+* Hash of the content (64 bits)
+* Size of the state (64 bits)
+* Size of the compressed state (64 bits)
+*/
+
+static uint64_t fnv1a(uint64_t hash, void const* const data, size_t const size) {
+    uint8_t const* const bytes = static_cast<uint8_t const*>(data);
+
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * UINT64_C(0x100000001b3);
+    }
+
+    return hash;
+}
+
+static uint64_t const fnvBasis = UINT64_C(0xcbf29ce484222325);
+
+static void put32(uint8_t* const p, uint32_t const value) {
+    for (unsigned i = 0; i < 4; i++) {
+        p[i] = (value >> (i * 8)) & 0xff;
+    }
+}
+
+static void put64(uint8_t* const p, uint64_t const value) {
+    for (unsigned i = 0; i < 8; i++) {
+        p[i] = (value >> (i * 8)) & 0xff;
+    }
+}
+
+static uint32_t get32(uint8_t const* const p) {
+    uint32_t value = 0;
+
+    for (unsigned i = 0; i < 4; i++) {
+        value |= static_cast<uint32_t>(p[i]) << (i * 8);
+    }
+
+    return value;
+}
+
+static uint64_t get64(uint8_t const* const p) {
+    uint64_t value = 0;
+
+    for (unsigned i = 0; i < 8; i++) {
+        value |= static_cast<uint64_t>(p[i]) << (i * 8);
+    }
+
+    return value;
+}
+
+hc::Savestates::Savestates(Desktop* desktop)
+    : View(desktop)
+    , _config(nullptr)
+    , _perf(nullptr)
+    , _coreHash(0)
+    , _contentHash(0)
+    , _slot(0)
+    , _jobSize(0)
+    , _jobSlot(0)
+    , _pending(false)
+    , _busy(false)
+    , _quit(false)
+{
+    memset(_exists, 0, sizeof(_exists));
+}
+
+void hc::Savestates::init(Config* const config, Perf* const perf) {
+    _config = config;
+    _perf = perf;
+}
+
+void hc::Savestates::setContent(char const* const path, void const* const data, size_t const size) {
+    char const* name = path;
+
+    for (char const* p = path; *p != 0; p++) {
+        if (*p == '/' || *p == '\\') {
+            name = p + 1;
+        }
+    }
+
+    char const* const dot = strrchr(name, '.');
+    _stem.assign(name, dot != nullptr ? dot - name : strlen(name));
+
+    if (data == nullptr) {
+        // Cores that load the content themselves only get the file name
+        _contentHash = fnv1a(fnvBasis, name, strlen(name));
+        return;
+    }
+
+    // Only hash the size and the ends of the content, so that big mapped
+    // content doesn't have to be read from disk in full
+    uint8_t const* const bytes = static_cast<uint8_t const*>(data);
+    uint64_t const size64 = size;
+    size_t const sample = size < 2 * ContentSample ? size : static_cast<size_t>(ContentSample);
+
+    _contentHash = fnv1a(fnvBasis, &size64, sizeof(size64));
+    _contentHash = fnv1a(_contentHash, bytes, sample);
+    _contentHash = fnv1a(_contentHash, bytes + size - sample, sample);
+}
+
+bool hc::Savestates::save(unsigned const slot) {
+    auto& frontend = lrcpp::Frontend::getInstance();
+    size_t size = 0;
+
+    if (slot >= SlotCount || !frontend.serializeSize(&size) || size == 0) {
+        _desktop->error(TAG "Cannot save the state to slot %u", slot);
+        return false;
+    }
+
+    {
+        // Only waits if the I/O thread didn't pick the previous save yet
+        std::unique_lock<std::mutex> lock(_mutex);
+        _idle.wait(lock, [this]() { return !_pending; });
+    }
+
+    if (_job.size() < size) {
+        _job.resize(size);
+    }
+
+    _perf->start(&_savePerf);
+    bool const ok = frontend.serialize(_job.data(), size);
+    _perf->stop(&_savePerf);
+
+    if (!ok) {
+        _desktop->error(TAG "Error serializing the state");
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _jobSize = size;
+    _jobSlot = slot;
+    _pending = true;
+    lock.unlock();
+
+    _gate.notify_one();
+    return true;
+}
+
+bool hc::Savestates::load(unsigned const slot, std::string* const error) {
+    if (slot >= SlotCount) {
+        *error = "invalid slot";
+        return false;
+    }
+
+    {
+        // Make sure the file is not being written
+        std::unique_lock<std::mutex> lock(_mutex);
+        _idle.wait(lock, [this]() { return !_pending && !_busy; });
+    }
+
+    _perf->start(&_loadPerf);
+
+    std::string const filePath = path(slot);
+    MappedFile file;
+
+    if (!file.open(filePath.c_str(), error)) {
+        _perf->stop(&_loadPerf);
+        return false;
+    }
+
+    uint8_t const* const header = static_cast<uint8_t const*>(file.data());
+
+    if (file.size() < HeaderSize || memcmp(header, "HCSS", 4) != 0) {
+        _perf->stop(&_loadPerf);
+        *error = "not a savestate file";
+        return false;
+    }
+
+    if (get32(header + 4) != Version) {
+        _perf->stop(&_loadPerf);
+        *error = "unsupported savestate version";
+        return false;
+    }
+
+    if (get64(header + 8) != _coreHash || get64(header + 16) != _contentHash) {
+        _perf->stop(&_loadPerf);
+        *error = "savestate is for a different core or content";
+        return false;
+    }
+
+    size_t const size = static_cast<size_t>(get64(header + 24));
+    size_t const compressed = static_cast<size_t>(get64(header + 32));
+
+    if (compressed > file.size() - HeaderSize) {
+        _perf->stop(&_loadPerf);
+        *error = "truncated savestate file";
+        return false;
+    }
+
+    if (_loading.size() < size) {
+        _loading.resize(size);
+    }
+
+    if (!Lz::decompress(header + HeaderSize, compressed, _loading.data(), size)) {
+        _perf->stop(&_loadPerf);
+        *error = "corrupted savestate file";
+        return false;
+    }
+
+    file.close();
+
+    bool const ok = lrcpp::Frontend::getInstance().unserialize(_loading.data(), size);
+    _perf->stop(&_loadPerf);
+
+    if (!ok) {
+        *error = "the core could not restore the state";
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _status = "Loaded slot " + std::to_string(slot);
+    return true;
+}
+
+std::string hc::Savestates::path(unsigned const slot) const {
+    std::string path = _config->getSavePath();
+
+    if (!path.empty() && path.back() != '/' && path.back() != '\\') {
+        path += '/';
+    }
+
+    path += _stem;
+    path += ".state";
+    path += std::to_string(slot);
+    return path;
+}
+
+hc::Savestates* hc::Savestates::check(lua_State* const L, int const index) {
+    return *static_cast<Savestates**>(luaL_checkudata(L, index, "hc::Savestates"));
+}
+
+char const* hc::Savestates::getTitle() {
+    return ICON_FA_FLOPPY_O " Savestates";
+}
+
+void hc::Savestates::onCoreLoaded() {
+    // Perf unregisters all counters when a core is unloaded
+    _savePerf.ident = "hc::savestates::save";
+    _perf->register_(&_savePerf);
+
+    _loadPerf.ident = "hc::savestates::load";
+    _perf->register_(&_loadPerf);
+}
+
+void hc::Savestates::onGameLoaded() {
+    retro_system_info info;
+    _coreHash = fnvBasis;
+
+    if (lrcpp::Frontend::getInstance().getSystemInfo(&info)) {
+        _coreHash = fnv1a(_coreHash, info.library_name, strlen(info.library_name) + 1);
+        _coreHash = fnv1a(_coreHash, info.library_version, strlen(info.library_version));
+    }
+
+    for (unsigned i = 0; i < SlotCount; i++) {
+        FILE* const file = fopen(path(i).c_str(), "rb");
+        _exists[i] = file != nullptr;
+
+        if (file != nullptr) {
+            fclose(file);
+        }
+    }
+
+    _status.clear();
+    startWriter();
+}
+
+void hc::Savestates::onDraw() {
+    ImGui::SliderInt("Slot", &_slot, 0, SlotCount - 1);
+
+    if (ImGui::Button(ICON_FA_FLOPPY_O " Save")) {
+        save(static_cast<unsigned>(_slot));
+    }
+
+    ImGui::SameLine();
+
+    if (ImGui::Button(ICON_FA_FOLDER_OPEN " Load")) {
+        std::string error;
+
+        if (!load(static_cast<unsigned>(_slot), &error)) {
+            _desktop->error(TAG "Error loading slot %d: %s", _slot, error.c_str());
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    ImGui::Text("Slot %d is %s", _slot, _exists[_slot] ? "in use" : "empty");
+
+    if (!_status.empty()) {
+        ImGui::Text("%s", _status.c_str());
+    }
+}
+
+void hc::Savestates::onGameUnloaded() {
+    // Pending saves are written before the thread exits
+    stopWriter();
+
+    std::vector<uint8_t>().swap(_job);
+    std::vector<uint8_t>().swap(_writing);
+    std::vector<uint8_t>().swap(_compressed);
+    std::vector<uint8_t>().swap(_loading);
+}
+
+int hc::Savestates::push(lua_State* const L) {
+    auto const self = static_cast<Savestates**>(lua_newuserdata(L, sizeof(Savestates*)));
+    *self = this;
+
+    if (luaL_newmetatable(L, "hc::Savestates")) {
+        static luaL_Reg const methods[] = {
+            {"save", l_save},
+            {"load", l_load},
+            {"exists", l_exists},
+            {"path", l_path},
+            {nullptr, nullptr}
+        };
+
+        luaL_newlib(L, methods);
+        lua_setfield(L, -2, "__index");
+    }
+
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+void hc::Savestates::writer() {
+    Trace::setThreadName("savestates");
+
+    for (;;) {
+        unsigned slot = 0;
+        size_t size = 0;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _gate.wait(lock, [this]() { return _pending || _quit; });
+
+            if (!_pending) {
+                return;
+            }
+
+            // Free _job so the next save doesn't have to wait for this one
+            _job.swap(_writing);
+            slot = _jobSlot;
+            size = _jobSize;
+            _pending = false;
+            _busy = true;
+        }
+
+        _idle.notify_all();
+        bool const ok = write(slot, size);
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _busy = false;
+            _exists[slot] = _exists[slot] || ok;
+        }
+
+        _idle.notify_all();
+    }
+}
+
+bool hc::Savestates::write(unsigned const slot, size_t const size) {
+    Trace::Scope scope("Savestates::write");
+    uint64_t const start = Pacer::now();
+
+    if (_compressed.size() < HeaderSize + Lz::bound(size)) {
+        _compressed.resize(HeaderSize + Lz::bound(size));
+    }
+
+    size_t const compressed = Lz::compress(_writing.data(), size, _compressed.data() + HeaderSize, _compressed.size() - HeaderSize);
+
+    uint8_t* const header = _compressed.data();
+    memcpy(header, "HCSS", 4);
+    put32(header + 4, Version);
+    put64(header + 8, _coreHash);
+    put64(header + 16, _contentHash);
+    put64(header + 24, size);
+    put64(header + 32, compressed);
+
+    // Write to a temporary file first so a crash never leaves a broken slot
+    std::string const finalPath = path(slot);
+    std::string const tempPath = finalPath + ".tmp";
+    FILE* const file = fopen(tempPath.c_str(), "wb");
+
+    if (file == nullptr) {
+        _desktop->error(TAG "Error opening \"%s\": %s", tempPath.c_str(), strerror(errno));
+        return false;
+    }
+
+    size_t const total = HeaderSize + compressed;
+    bool const ok = fwrite(_compressed.data(), 1, total, file) == total;
+
+    if (fclose(file) != 0 || !ok) {
+        _desktop->error(TAG "Error writing to \"%s\": %s", tempPath.c_str(), strerror(errno));
+        remove(tempPath.c_str());
+        return false;
+    }
+
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
+    // rename doesn't replace existing files on Windows
+    remove(finalPath.c_str());
+#endif
+
+    if (rename(tempPath.c_str(), finalPath.c_str()) != 0) {
+        _desktop->error(TAG "Error renaming \"%s\": %s", tempPath.c_str(), strerror(errno));
+        remove(tempPath.c_str());
+        return false;
+    }
+
+    double const ms = (Pacer::now() - start) / 1000000.0;
+    char status[128];
+
+    snprintf(
+        status, sizeof(status), "Saved slot %u, %zu KiB compressed to %zu KiB in %.3f ms",
+        slot, size / 1024, compressed / 1024, ms
+    );
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _status = status;
+    return true;
+}
+
+void hc::Savestates::startWriter() {
+    _pending = false;
+    _busy = false;
+    _quit = false;
+    _writerThread = std::thread(&Savestates::writer, this);
+}
+
+void hc::Savestates::stopWriter() {
+    if (!_writerThread.joinable()) {
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+
+    _gate.notify_one();
+    _writerThread.join();
+}
+
+int hc::Savestates::l_save(lua_State* const L) {
+    auto const self = check(L, 1);
+    lua_Integer const slot = luaL_checkinteger(L, 2);
+
+    if (slot < 0 || slot >= SlotCount) {
+        return luaL_error(L, "invalid slot %I", slot);
+    }
+
+    lua_pushboolean(L, self->save(static_cast<unsigned>(slot)));
+    return 1;
+}
+
+int hc::Savestates::l_load(lua_State* const L) {
+    auto const self = check(L, 1);
+    lua_Integer const slot = luaL_checkinteger(L, 2);
+
+    if (slot < 0 || slot >= SlotCount) {
+        return luaL_error(L, "invalid slot %I", slot);
+    }
+
+    std::string error;
+
+    if (!self->load(static_cast<unsigned>(slot), &error)) {
+        lua_pushboolean(L, 0);
+        lua_pushstring(L, error.c_str());
+        return 2;
+    }
+
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+int hc::Savestates::l_exists(lua_State* const L) {
+    auto const self = check(L, 1);
+    lua_Integer const slot = luaL_checkinteger(L, 2);
+
+    if (slot < 0 || slot >= SlotCount) {
+        return luaL_error(L, "invalid slot %I", slot);
+    }
+
+    std::unique_lock<std::mutex> lock(self->_mutex);
+    lua_pushboolean(L, self->_exists[slot]);
+    return 1;
+}
+
+int hc::Savestates::l_path(lua_State* const L) {
+    auto const self = check(L, 1);
+    lua_Integer const slot = luaL_checkinteger(L, 2);
+
+    if (slot < 0 || slot >= SlotCount) {
+        return luaL_error(L, "invalid slot %I", slot);
+    }
+
+    std::string const path = self->path(static_cast<unsigned>(slot));
+    lua_pushlstring(L, path.c_str(), path.length());
+    return 1;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "Desktop.h"
+#include "Scriptable.h"
+
+#include <lrcpp/Components.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace hc {
+    class Config;
+
+    // Numbered savestate slots on disk. Saving only copies the state out of
+    // the core, compression and writing happen in a dedicated I/O thread.
+    // Files carry hashes of the core and the content, and are mapped into
+    // memory and decompressed straight into a reusable buffer when loaded.
+    class Savestates : public View, public Scriptable {
+    public:
+        enum {
+            SlotCount = 10
+        };
+
+        Savestates(Desktop* desktop);
+        virtual ~Savestates() {}
+
+        void init(Config* const config, Perf* const perf);
+
+        // Identifies the content being loaded, data is null for cores that
+        // load the content themselves
+        void setContent(char const* const path, void const* const data, size_t const size);
+
+        // Both must be called with the core mutex held
+        bool save(unsigned const slot);
+        bool load(unsigned const slot, std::string* const error);
+
+        std::string path(unsigned const slot) const;
+
+        static Savestates* check(lua_State* const L, int const index);
+
+        // hc::View
+        virtual char const* getTitle() override;
+        virtual void onCoreLoaded() override;
+        virtual void onGameLoaded() override;
+        virtual void onDraw() override;
+        virtual void onGameUnloaded() override;
+
+        // hc::Scriptable
+        virtual int push(lua_State* const L) override;
+
+    protected:
+        enum {
+            HeaderSize = 40,
+            // 2 hashes the size and a sample of the content instead of all
+            // of it
+            Version = 2,
+            // Bytes hashed at the start and at the end of the content
+            ContentSample = 64 * 1024
+        };
+
+        void writer();
+        bool write(unsigned const slot, size_t const size);
+        void startWriter();
+        void stopWriter();
+
+        static int l_save(lua_State* const L);
+        static int l_load(lua_State* const L);
+        static int l_exists(lua_State* const L);
+        static int l_path(lua_State* const L);
+
+        Config* _config;
+        Perf* _perf;
+        retro_perf_counter _savePerf;
+        retro_perf_counter _loadPerf;
+
+        std::string _stem;
+        uint64_t _coreHash;
+        uint64_t _contentHash;
+
+        int _slot;
+        bool _exists[SlotCount];
+
+        // Buffers are kept between saves and loads, _job is filled by the
+        // emulation thread and swapped with _writing by the I/O thread
+        std::vector<uint8_t> _job;
+        std::vector<uint8_t> _writing;
+        std::vector<uint8_t> _compressed;
+        std::vector<uint8_t> _loading;
+
+        std::thread _writerThread;
+        std::mutex _mutex;
+        std::condition_variable _gate;
+        std::condition_variable _idle;
+        size_t _jobSize;
+        unsigned _jobSlot;
+        bool _pending;
+        bool _busy;
+        bool _quit;
+
+        // Result of the last operation, shown in the view
+        std::string _status;
+    };
+}
@@ -0,0 +1,315 @@
+#include "StateMemory.h"
+#include "Perf.h"
+
+#include <lrcpp/Frontend.h>
+
+#include <IconsFontAwesome4.h>
+
+#include <inttypes.h>
+
+#ifdef _USE_SSE2
+#include <emmintrin.h>
+#endif
+
+extern "C" {
+    #include "lauxlib.h"
+}
+
+#define TAG "[STM] "
+
+// changed |= previous ^ current, previous = current
+static void accumulate(uint8_t* const changed, uint8_t* const previous, uint8_t const* const current, size_t const size) {
+    size_t i = 0;
+
+#ifdef _USE_SSE2
+    for (; i + 16 <= size; i += 16) {
+        __m128i const p = _mm_loadu_si128(reinterpret_cast<__m128i const*>(previous + i));
+        __m128i const c = _mm_loadu_si128(reinterpret_cast<__m128i const*>(current + i));
+        __m128i const x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(changed + i));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(changed + i), _mm_or_si128(x, _mm_xor_si128(p, c)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(previous + i), c);
+    }
+#endif
+
+    for (; i < size; i++) {
+        changed[i] |= previous[i] ^ current[i];
+        previous[i] = current[i];
+    }
+}
+
+// Returns the index of the first non-zero byte at or after start, or size
+static size_t findNonZero(uint8_t const* const data, size_t start, size_t const size) {
+#ifdef _USE_SSE2
+    __m128i const zero = _mm_setzero_si128();
+
+    for (; start + 16 <= size; start += 16) {
+        __m128i const x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + start));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) != 0xffff) {
+            break;
+        }
+    }
+#endif
+
+    while (start < size && data[start] == 0) {
+        start++;
+    }
+
+    return start;
+}
+
+hc::StateMemory::StateMemory(Desktop* desktop)
+    : View(desktop)
+    , _memorySelector(nullptr)
+    , _perf(nullptr)
+    , _enabled(false)
+    , _added(false)
+    , _size(0)
+    , _remaining(0)
+    , _analyzed(0)
+    , _frames(60)
+{}
+
+void hc::StateMemory::init(MemorySelector* const memorySelector, Perf* const perf) {
+    _memorySelector = memorySelector;
+    _perf = perf;
+}
+
+void hc::StateMemory::setEnabled(bool const enabled) {
+    _enabled = enabled;
+
+    if (enabled && !_added && refresh()) {
+        // The selector forgets all regions when the game is unloaded
+        _memorySelector->add(&_region);
+        _added = true;
+        _desktop->info(TAG "Added the savestate as memory, %zu bytes", _size);
+    }
+}
+
+void hc::StateMemory::analyze(unsigned const frames) {
+    // One more frame to have something to compare to
+    _remaining = frames + 1;
+    _analyzed = 0;
+    _previous.clear();
+    _areas.clear();
+}
+
+hc::StateMemory* hc::StateMemory::check(lua_State* const L, int const index) {
+    return *static_cast<StateMemory**>(luaL_checkudata(L, index, "hc::StateMemory"));
+}
+
+char const* hc::StateMemory::getTitle() {
+    return ICON_FA_MICROCHIP " State Memory";
+}
+
+void hc::StateMemory::onCoreLoaded() {
+    // Perf unregisters all counters when a core is unloaded
+    _serializePerf.ident = "hc::statememory";
+    _perf->register_(&_serializePerf);
+}
+
+void hc::StateMemory::onFrame() {
+    if ((!_enabled && _remaining == 0) || !refresh()) {
+        return;
+    }
+
+    if (_remaining == 0) {
+        return;
+    }
+
+    if (_previous.size() != _size) {
+        // First frame, or the state size changed and the analysis restarts
+        _previous.assign(_blob.begin(), _blob.begin() + _size);
+        _changed.assign(_size, 0);
+        _analyzed = 0;
+    }
+    else {
+        accumulate(_changed.data(), _previous.data(), _blob.data(), _size);
+        _analyzed++;
+    }
+
+    if (--_remaining == 0) {
+        findAreas();
+    }
+}
+
+void hc::StateMemory::onDraw() {
+    bool enabled = _enabled;
+
+    if (ImGui::Checkbox("Expose the savestate as memory", &enabled)) {
+        setEnabled(enabled);
+    }
+
+    ImGui::Text("%zu bytes", _size);
+
+    ImGui::SliderInt("Frames", &_frames, 2, 600);
+    ImGui::SameLine();
+
+    if (ImGui::Button(ICON_FA_SEARCH " Analyze")) {
+        analyze(static_cast<unsigned>(_frames));
+    }
+
+    if (_remaining != 0) {
+        ImGui::Text("Analyzing, %u frames to go", _remaining);
+        return;
+    }
+
+    uint64_t total = 0;
+
+    for (auto const& area : _areas) {
+        total += area.size;
+    }
+
+    ImGui::Text("%zu volatile areas, %" PRIu64 " bytes, in %u frames", _areas.size(), total, _analyzed);
+
+    if (_areas.empty()) {
+        return;
+    }
+
+    ImGui::BeginChild("##areas");
+    ImGui::Columns(2);
+    ImGui::Text("Offset");
+    ImGui::NextColumn();
+    ImGui::Text("Size");
+    ImGui::NextColumn();
+    ImGui::Separator();
+
+    for (auto const& area : _areas) {
+        ImGui::Text("0x%08" PRIx64, area.offset);
+        ImGui::NextColumn();
+        ImGui::Text("%" PRIu64, area.size);
+        ImGui::NextColumn();
+    }
+
+    ImGui::Columns(1);
+    ImGui::EndChild();
+}
+
+void hc::StateMemory::onGameUnloaded() {
+    _enabled = _added = false;
+    _remaining = 0;
+    _size = 0;
+    _region.set(nullptr, 0);
+
+    std::vector<uint8_t>().swap(_blob);
+    std::vector<uint8_t>().swap(_previous);
+    std::vector<uint8_t>().swap(_changed);
+    _areas.clear();
+}
+
+int hc::StateMemory::push(lua_State* const L) {
+    auto const self = static_cast<StateMemory**>(lua_newuserdata(L, sizeof(StateMemory*)));
+    *self = this;
+
+    if (luaL_newmetatable(L, "hc::StateMemory")) {
+        static luaL_Reg const methods[] = {
+            {"enable", l_enable},
+            {"analyze", l_analyze},
+            {"areas", l_areas},
+            {nullptr, nullptr}
+        };
+
+        luaL_newlib(L, methods);
+        lua_setfield(L, -2, "__index");
+    }
+
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+bool hc::StateMemory::refresh() {
+    auto& frontend = lrcpp::Frontend::getInstance();
+    size_t size = 0;
+
+    if (!frontend.serializeSize(&size) || size == 0) {
+        return false;
+    }
+
+    if (_blob.size() < size) {
+        _blob.resize(size);
+    }
+
+    _perf->start(&_serializePerf);
+    bool const ok = frontend.serialize(_blob.data(), size);
+    _perf->stop(&_serializePerf);
+
+    if (!ok) {
+        return false;
+    }
+
+    _size = size;
+    _region.set(_blob.data(), size);
+    return true;
+}
+
+void hc::StateMemory::findAreas() {
+    _areas.clear();
+    uint8_t const* const changed = _changed.data();
+    size_t offset = findNonZero(changed, 0, _size);
+
+    while (offset < _size) {
+        size_t end = offset + 1;
+
+        while (end < _size && changed[end] != 0) {
+            end++;
+        }
+
+        if (!_areas.empty() && offset - (_areas.back().offset + _areas.back().size) <= AreaGap) {
+            _areas.back().size = end - _areas.back().offset;
+        }
+        else {
+            Area const area = {offset, end - offset};
+            _areas.push_back(area);
+        }
+
+        offset = findNonZero(changed, end, _size);
+    }
+
+    _desktop->info(TAG "Found %zu volatile areas in %u frames", _areas.size(), _analyzed);
+}
+
+int hc::StateMemory::l_enable(lua_State* const L) {
+    auto const self = check(L, 1);
+    self->setEnabled(lua_toboolean(L, 2) != 0);
+    return 0;
+}
+
+int hc::StateMemory::l_analyze(lua_State* const L) {
+    auto const self = check(L, 1);
+    lua_Integer const frames = luaL_checkinteger(L, 2);
+
+    if (frames < 1) {
+        return luaL_error(L, "invalid number of frames %I", frames);
+    }
+
+    self->analyze(static_cast<unsigned>(frames));
+    return 0;
+}
+
+int hc::StateMemory::l_areas(lua_State* const L) {
+    auto const self = check(L, 1);
+
+    if (self->_remaining != 0) {
+        // Analysis still running
+        lua_pushnil(L);
+        return 1;
+    }
+
+    lua_createtable(L, static_cast<int>(self->_areas.size()), 0);
+    lua_Integer index = 1;
+
+    for (auto const& area : self->_areas) {
+        lua_createtable(L, 0, 2);
+
+        lua_pushinteger(L, static_cast<lua_Integer>(area.offset));
+        lua_setfield(L, -2, "offset");
+
+        lua_pushinteger(L, static_cast<lua_Integer>(area.size));
+        lua_setfield(L, -2, "size");
+
+        lua_rawseti(L, -2, index++);
+    }
+
+    return 1;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "Desktop.h"
+#include "Scriptable.h"
+#include "Memory.h"
+
+#include <lrcpp/Components.h>
+
+#include <stdint.h>
+#include <vector>
+
+namespace hc {
+    // The serialized state of the core as a read-only memory region
+    class StateRegion : public Memory {
+    public:
+        StateRegion() : _data(nullptr), _size(0) {}
+        virtual ~StateRegion() {}
+
+        void set(uint8_t const* const data, uint64_t const size) { _data = data; _size = size; }
+
+        // hc::Memory
+        virtual char const* id() const override { return "state"; }
+        virtual char const* name() const override { return "Savestate"; }
+        virtual uint64_t base() const override { return 0; }
+        virtual uint64_t size() const override { return _size; }
+        virtual bool readonly() const override { return true; }
+        virtual uint8_t peek(uint64_t address) const override { return address < _size ? _data[address] : 0; }
+        virtual void poke(uint64_t address, uint8_t value) override { (void)address; (void)value; }
+
+    protected:
+        uint8_t const* _data;
+        uint64_t _size;
+    };
+
+    // Exposes the savestate as a memory region for cores that don't expose
+    // their memory via retro_get_memory_data, refreshing it every frame. It
+    // can also find the areas of the state that change between frames.
+    class StateMemory : public View, public Scriptable {
+    public:
+        StateMemory(Desktop* desktop);
+        virtual ~StateMemory() {}
+
+        void init(MemorySelector* const memorySelector, Perf* const perf);
+
+        void setEnabled(bool const enabled);
+
+        // Starts looking for the areas that change in the next frames
+        void analyze(unsigned const frames);
+
+        static StateMemory* check(lua_State* const L, int const index);
+
+        // hc::View
+        virtual char const* getTitle() override;
+        virtual void onCoreLoaded() override;
+        virtual void onFrame() override;
+        virtual void onDraw() override;
+        virtual void onGameUnloaded() override;
+
+        // hc::Scriptable
+        virtual int push(lua_State* const L) override;
+
+    protected:
+        // An area of the state that changed during the analysis
+        struct Area {
+            uint64_t offset;
+            uint64_t size;
+        };
+
+        enum {
+            // Areas closer than this are merged
+            AreaGap = 16
+        };
+
+        bool refresh();
+        void findAreas();
+
+        static int l_enable(lua_State* const L);
+        static int l_analyze(lua_State* const L);
+        static int l_areas(lua_State* const L);
+
+        MemorySelector* _memorySelector;
+        Perf* _perf;
+        retro_perf_counter _serializePerf;
+
+        StateRegion _region;
+        bool _enabled;
+        bool _added;
+
+        // Reused between frames, only grow
+        std::vector<uint8_t> _blob;
+        size_t _size;
+
+        std::vector<uint8_t> _previous;
+        std::vector<uint8_t> _changed;
+        unsigned _remaining;
+        unsigned _analyzed;
+        int _frames;
+
+        std::vector<Area> _areas;
+    };
+}
@@ -0,0 +1,235 @@
+#include "Trace.h"
+#include "Perf.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+    enum {
+        // Events kept per thread, older ones are overwritten
+        Capacity = 1 << 17,
+        NameSize = 38
+    };
+
+    struct Event {
+        uint64_t timestamp;
+        char name[NameSize];
+        char phase;
+        char unused;
+    };
+
+    // Written only by the owner thread, read when exporting
+    struct Buffer {
+        Buffer() : head(0), inUse(true), tid(0) {}
+
+        std::vector<Event> events;
+        std::atomic<uint64_t> head;
+        std::atomic<bool> inUse;
+        unsigned tid;
+        std::string threadName;
+    };
+
+    // Buffers are never freed, buffers of finished threads are reused
+    std::mutex buffersMutex;
+    std::vector<Buffer*> buffers;
+    std::atomic<bool> traceEnabled(false);
+    unsigned nextTid = 1;
+
+    class ThreadBuffer {
+    public:
+        ThreadBuffer() : _buffer(nullptr) {}
+
+        ~ThreadBuffer() {
+            if (_buffer != nullptr) {
+                _buffer->inUse.store(false, std::memory_order_release);
+            }
+        }
+
+        // Buffers are only allocated when the thread records its first event
+        Buffer* get() {
+            if (_buffer == nullptr) {
+                _buffer = acquire(_name);
+            }
+
+            return _buffer;
+        }
+
+        void setName(char const* const name) {
+            _name = name;
+
+            if (_buffer != nullptr) {
+                std::lock_guard<std::mutex> lock(buffersMutex);
+                _buffer->threadName = _name;
+            }
+        }
+
+    protected:
+        static Buffer* acquire(std::string const& name) {
+            std::lock_guard<std::mutex> lock(buffersMutex);
+
+            for (auto const buffer : buffers) {
+                bool expected = false;
+
+                if (buffer->inUse.compare_exchange_strong(expected, true)) {
+                    buffer->head.store(0, std::memory_order_relaxed);
+                    buffer->tid = nextTid++;
+                    buffer->threadName = name;
+                    return buffer;
+                }
+            }
+
+            Buffer* const buffer = new Buffer;
+            buffer->events.resize(Capacity);
+            buffer->tid = nextTid++;
+            buffer->threadName = name;
+            buffers.emplace_back(buffer);
+            return buffer;
+        }
+
+        Buffer* _buffer;
+        std::string _name;
+    };
+
+    thread_local ThreadBuffer threadBuffer;
+
+    void record(char const* const name, char const phase) {
+        Buffer* const buffer = threadBuffer.get();
+        uint64_t const head = buffer->head.load(std::memory_order_relaxed);
+        Event& event = buffer->events[head & (Capacity - 1)];
+
+        event.timestamp = hc::Perf::getTimeNs();
+        event.phase = phase;
+        strncpy(event.name, name, NameSize - 1);
+        event.name[NameSize - 1] = 0;
+
+        buffer->head.store(head + 1, std::memory_order_release);
+    }
+
+    void writeString(FILE* const file, char const* str) {
+        fputc('"', file);
+
+        for (; *str != 0; str++) {
+            unsigned char const k = static_cast<unsigned char>(*str);
+
+            if (k == '"' || k == '\\') {
+                fputc('\\', file);
+                fputc(k, file);
+            }
+            else if (k < 32) {
+                fprintf(file, "\\u%04x", k);
+            }
+            else {
+                fputc(k, file);
+            }
+        }
+
+        fputc('"', file);
+    }
+}
+
+void hc::Trace::enable(bool const enabled) {
+    traceEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool hc::Trace::enabled() {
+    return traceEnabled.load(std::memory_order_relaxed);
+}
+
+void hc::Trace::begin(char const* const name) {
+    if (traceEnabled.load(std::memory_order_relaxed)) {
+        record(name, 'B');
+    }
+}
+
+void hc::Trace::end(char const* const name) {
+    if (traceEnabled.load(std::memory_order_relaxed)) {
+        record(name, 'E');
+    }
+}
+
+void hc::Trace::setThreadName(char const* const name) {
+    threadBuffer.setName(name);
+}
+
+bool hc::Trace::save(char const* const path, double const seconds) {
+    FILE* const file = fopen(path, "w");
+
+    if (file == nullptr) {
+        return false;
+    }
+
+    uint64_t const now = Perf::getTimeNs();
+    uint64_t const window = static_cast<uint64_t>(seconds * 1000000000.0);
+    uint64_t const since = seconds > 0.0 && window < now ? now - window : 0;
+
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    std::vector<Event> events;
+    bool first = true;
+
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", file);
+
+    for (auto const buffer : buffers) {
+        uint64_t const head = buffer->head.load(std::memory_order_acquire);
+        uint64_t const tail = head > Capacity ? head - Capacity : 0;
+
+        events.clear();
+
+        for (uint64_t i = tail; i < head; i++) {
+            events.push_back(buffer->events[i & (Capacity - 1)]);
+        }
+
+        // Events the owner thread overwrote while they were copied, including
+        // the one it may be writing right now, are dropped
+        uint64_t const after = buffer->head.load(std::memory_order_acquire) + 1;
+        size_t const overwritten = after - tail > Capacity ? static_cast<size_t>(after - tail - Capacity) : 0;
+        size_t const skip = std::min(overwritten, events.size());
+
+        if (!first) {
+            fputs(",\n", file);
+        }
+
+        first = false;
+
+        char name[64];
+        snprintf(name, sizeof(name), "thread %u", buffer->tid);
+
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", buffer->tid);
+        writeString(file, buffer->threadName.empty() ? name : buffer->threadName.c_str());
+        fputs("}}", file);
+
+        for (size_t i = skip; i < events.size(); i++) {
+            Event const& event = events[i];
+
+            if (event.timestamp < since) {
+                continue;
+            }
+
+            fputs(",\n{\"name\":", file);
+            writeString(file, event.name);
+            fprintf(
+                file, ",\"ph\":\"%c\",\"ts\":%" PRIu64 ".%03u,\"pid\":1,\"tid\":%u}",
+                event.phase, event.timestamp / 1000, static_cast<unsigned>(event.timestamp % 1000), buffer->tid
+            );
+        }
+    }
+
+    fputs("\n]}\n", file);
+    return fclose(file) == 0;
+}
+
+void hc::Trace::clear() {
+    std::lock_guard<std::mutex> lock(buffersMutex);
+
+    for (auto const buffer : buffers) {
+        // Not exact if the owner is recording, but only meant to drop the
+        // bulk of the old events
+        buffer->head.store(0, std::memory_order_relaxed);
+    }
+}
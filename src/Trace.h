@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace hc {
+    // Records begin and end events of named spans into per-thread rings, and
+    // exports them in the Chrome trace format that chrome://tracing and
+    // Perfetto can open. Recording is lock-free and does nothing when
+    // tracing is disabled.
+    class Trace final {
+    public:
+        // Begins a span when constructed and ends it when destroyed
+        class Scope final {
+        public:
+            Scope(char const* const name) : _name(name), _active(Trace::enabled()) { if (_active) Trace::begin(name); }
+            ~Scope() { if (_active) Trace::end(_name); }
+
+        protected:
+            Scope(Scope const&) = delete;
+            Scope& operator=(Scope const&) = delete;
+
+            char const* const _name;
+            bool const _active;
+        };
+
+        static void enable(bool const enabled);
+        static bool enabled();
+
+        // Names are copied, and truncated if too long
+        static void begin(char const* const name);
+        static void end(char const* const name);
+
+        // Names the calling thread in the exported traces, doesn't allocate
+        // the thread's ring
+        static void setThreadName(char const* const name);
+
+        // Saves the events recorded in the last seconds, or all of them if
+        // seconds is zero
+        static bool save(char const* const path, double const seconds);
+
+        // Drops all events recorded so far
+        static void clear();
+    };
+}
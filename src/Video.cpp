@@ -1,5 +1,7 @@
 #include "Video.h"
 #include "Logger.h"
+#include "Perf.h"
+#include "Trace.h"
 
 #include <IconsFontAwesome4.h>
 
@@ -9,9 +11,22 @@ extern "C" {
 
 #define TAG "[VID] "
 
-hc::Video::Video(Desktop* desktop) : View(desktop), _mouseOnTexture(false) {}
-
-void hc::Video::init() {
+hc::Video::Video(Desktop* desktop)
+    : View(desktop)
+    , _turbo(false)
+    , _discard(false)
+    , _headless(false)
+    , _captureFrames(false)
+    , _maxWidth(0)
+    , _maxHeight(0)
+    , _aspectRatio(1.0f)
+    , _mouseOnTexture(false)
+{}
+
+void hc::Video::init(bool const headless, Perf* const perf) {
+    _headless = headless;
+    _perf = perf;
+    _copyPerf.start = _copyPerf.total = _copyPerf.call_cnt = 0;
     _rotation = 0;
     _pixelFormat = RETRO_PIXEL_FORMAT_UNKNOWN;
     _coreFps = 0.0;
@@ -25,6 +40,77 @@ double hc::Video::getCoreFps() const {
     return _coreFps;
 }
 
+void hc::Video::present() {
+    unsigned const maxWidth = _maxWidth.load(std::memory_order_relaxed);
+    unsigned const maxHeight = _maxHeight.load(std::memory_order_relaxed);
+
+    if (maxWidth == 0 || maxHeight == 0) {
+        // The game was unloaded, possibly from another thread
+        if (_texture != 0) {
+            glDeleteTextures(1, &_texture);
+            _texture = 0;
+            _textureWidth = _textureHeight = 0;
+            _width = _height = 0;
+        }
+
+        return;
+    }
+
+    setupTexture(maxWidth, maxHeight);
+
+    Frame const* const frame = _frames.acquire();
+
+    if (frame == nullptr || frame->width > _textureWidth || frame->height > _textureHeight) {
+        return;
+    }
+
+    GLint previous_texture;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous_texture);
+    glBindTexture(GL_TEXTURE_2D, _texture);
+
+    void const* const data = frame->pixels.data();
+    unsigned const width = frame->width;
+    unsigned const height = frame->height;
+
+    switch (_pixelFormat) {
+        case RETRO_PIXEL_FORMAT_XRGB8888:
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, frame->pitch / 4);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, data);
+            break;
+
+        case RETRO_PIXEL_FORMAT_RGB565:
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, frame->pitch / 2);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, data);
+            break;
+
+        case RETRO_PIXEL_FORMAT_0RGB1555:
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, frame->pitch / 2);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, data);
+            break;
+
+        case RETRO_PIXEL_FORMAT_UNKNOWN:
+            break;
+    }
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, previous_texture);
+
+    _width = width;
+    _height = height;
+}
+
+void hc::Video::setTurbo(bool const turbo) {
+    _turbo = turbo;
+}
+
+void hc::Video::setDiscard(bool const discard) {
+    _discard = discard;
+}
+
+hc::Video* hc::Video::check(lua_State* const L, int const index) {
+    return *static_cast<Video**>(luaL_checkudata(L, index, "hc::Video"));
+}
+
 bool hc::Video::getMousePos(int* const x, int* const y) const {
     *x = _mousePos.x;
     *y = _mousePos.y;
@@ -35,6 +121,12 @@ char const* hc::Video::getTitle() {
     return ICON_FA_DESKTOP " Video";
 }
 
+void hc::Video::onCoreLoaded() {
+    // Perf unregisters all counters when a core is unloaded
+    _copyPerf.ident = "hc::video";
+    _perf->register_(&_copyPerf);
+}
+
 void hc::Video::onDraw() {
     if (_texture != 0) {
         _texturePos = ImGui::GetCursorScreenPos();
@@ -42,12 +134,13 @@ void hc::Video::onDraw() {
         ImVec2 const min = ImGui::GetWindowContentRegionMin();
         ImVec2 const max = ImGui::GetWindowContentRegionMax();
 
+        float const aspectRatio = _aspectRatio.load(std::memory_order_relaxed);
         float height = max.y - min.y;
-        float width = height * _aspectRatio;
+        float width = height * aspectRatio;
 
         if (width > max.x - min.x) {
             width = max.x - min.x;
-            height = width / _aspectRatio;
+            height = width / aspectRatio;
         }
 
         ImVec2 const size = ImVec2(width, height);
@@ -68,16 +161,34 @@ void hc::Video::onDraw() {
 }
 
 void hc::Video::onGameUnloaded() {
-    glDeleteTextures(1, &_texture);
-    _texture = 0;
-    _textureWidth = _textureHeight = 0;
-    _width = _height = 0;
+    // The texture is deleted in present, in the thread that owns the context
+    _maxWidth = _maxHeight = 0;
+    _copyPerf.start = _copyPerf.total = _copyPerf.call_cnt = 0;
 }
 
 void hc::Video::onCoreUnloaded() {
     _pixelFormat = RETRO_PIXEL_FORMAT_UNKNOWN;
 }
 
+int hc::Video::push(lua_State* const L) {
+    auto const self = static_cast<Video**>(lua_newuserdata(L, sizeof(Video*)));
+    *self = this;
+
+    if (luaL_newmetatable(L, "hc::Video")) {
+        static luaL_Reg const methods[] = {
+            {"captureFrames", l_captureFrames},
+            {"getFrame", l_getFrame},
+            {nullptr, nullptr}
+        };
+
+        luaL_newlib(L, methods);
+        lua_setfield(L, -2, "__index");
+    }
+
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
 bool hc::Video::setRotation(unsigned rotation) {
     _rotation = rotation;
     _desktop->info(TAG "Set rotation to %u", rotation);
@@ -139,12 +250,14 @@ bool hc::Video::setSystemAvInfo(retro_system_av_info const* info) {
 }
 
 bool hc::Video::setGeometry(retro_game_geometry const* geometry) {
-    _aspectRatio = geometry->aspect_ratio;
+    float aspectRatio = geometry->aspect_ratio;
 
-    if (_aspectRatio <= 0) {
-        _aspectRatio = (float)geometry->base_width / (float)geometry->base_height;
+    if (aspectRatio <= 0) {
+        aspectRatio = (float)geometry->base_width / (float)geometry->base_height;
     }
 
+    _aspectRatio = aspectRatio;
+
     _desktop->info(TAG "Setting geometry");
 
     _desktop->info(TAG "    base_width   = %u", geometry->base_width);
@@ -153,7 +266,10 @@ bool hc::Video::setGeometry(retro_game_geometry const* geometry) {
     _desktop->info(TAG "    max_height   = %u", geometry->max_height);
     _desktop->info(TAG "    aspect_ratio = %f", geometry->aspect_ratio);
 
-    setupTexture(geometry->max_width, geometry->max_height);
+    // This can be called from the emulation thread, the texture is resized
+    // in present
+    _maxWidth = geometry->max_width;
+    _maxHeight = geometry->max_height;
     return true;
 }
 
@@ -191,39 +307,49 @@ bool hc::Video::getPreferredHwRender(unsigned* preferred) {
 }
 
 void hc::Video::refresh(void const* data, unsigned width, unsigned height, size_t pitch) {
-    if (data == nullptr || data == RETRO_HW_FRAME_BUFFER_VALID) {
+    Trace::Scope scope("Video::refresh");
+
+    if (data == nullptr || data == RETRO_HW_FRAME_BUFFER_VALID || _discard) {
+        return;
+    }
+    else if (_turbo && !_frames.consumed()) {
+        // The UI hasn't shown the previous frame yet, don't bother copying
+        return;
+    }
+    else if (_headless && !_captureFrames) {
+        // Nobody will ever look at the frame
         return;
     }
 
-    GLint previous_texture;
-    glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous_texture);
-    glBindTexture(GL_TEXTURE_2D, _texture);
+    size_t const bpp = _pixelFormat == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2;
+    size_t const rowSize = width * bpp;
 
-    switch (_pixelFormat) {
-        case RETRO_PIXEL_FORMAT_XRGB8888:
-            glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch / 4);
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, data);
-            break;
+    // Copy the frame out of the core, the UI thread will upload it later
+    _perf->start(&_copyPerf);
+    Frame& frame = _frames.writeBuffer();
 
-        case RETRO_PIXEL_FORMAT_RGB565:
-            glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch / 2);
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, data);
-            break;
+    if (frame.pixels.size() < rowSize * height) {
+        frame.pixels.resize(rowSize * height);
+    }
 
-        case RETRO_PIXEL_FORMAT_0RGB1555:
-            glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch / 2);
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, data);
-            break;
+    uint8_t const* source = static_cast<uint8_t const*>(data);
+    uint8_t* dest = frame.pixels.data();
 
-        case RETRO_PIXEL_FORMAT_UNKNOWN:
-            break;
+    if (pitch == rowSize) {
+        memcpy(dest, source, rowSize * height);
+    }
+    else {
+        for (unsigned y = 0; y < height; y++, source += pitch, dest += rowSize) {
+            memcpy(dest, source, rowSize);
+        }
     }
 
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-    glBindTexture(GL_TEXTURE_2D, previous_texture);
+    frame.width = width;
+    frame.height = height;
+    frame.pitch = rowSize;
 
-    _width = width;
-    _height = height;
+    _frames.publish();
+    _perf->stop(&_copyPerf);
 }
 
 uintptr_t hc::Video::getCurrentFramebuffer() {
@@ -273,3 +399,41 @@ void hc::Video::setupTexture(unsigned const width, unsigned const height) {
     glBindTexture(GL_TEXTURE_2D, previous_texture);
     _desktop->info(TAG "Texture set to %u x %u", width, height);
 }
+
+int hc::Video::l_captureFrames(lua_State* const L) {
+    auto const self = check(L, 1);
+    self->_captureFrames = lua_toboolean(L, 2) != 0;
+    return 0;
+}
+
+int hc::Video::l_getFrame(lua_State* const L) {
+    auto const self = check(L, 1);
+
+    if (!self->_headless) {
+        // The UI thread owns the consumer side of the mailbox
+        return luaL_error(L, "frames can only be read in headless mode");
+    }
+
+    self->_frames.acquire();
+    Frame const& frame = self->_frames.readBuffer();
+
+    if (frame.pixels.empty()) {
+        return 0;
+    }
+
+    char const* format = "unknown";
+
+    switch (self->_pixelFormat) {
+        case RETRO_PIXEL_FORMAT_0RGB1555: format = "0rgb1555"; break;
+        case RETRO_PIXEL_FORMAT_XRGB8888: format = "xrgb8888"; break;
+        case RETRO_PIXEL_FORMAT_RGB565:   format = "rgb565"; break;
+        default: break;
+    }
+
+    lua_pushlstring(L, reinterpret_cast<char const*>(frame.pixels.data()), frame.pitch * frame.height);
+    lua_pushinteger(L, frame.width);
+    lua_pushinteger(L, frame.height);
+    lua_pushinteger(L, frame.pitch);
+    lua_pushstring(L, format);
+    return 5;
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "Desktop.h"
+#include "Scriptable.h"
+#include "Mailbox.h"
 
 #include <lrcpp/Components.h>
 
@@ -8,23 +10,50 @@
 #include <SDL_opengl.h>
 
 #include <stdint.h>
+#include <atomic>
+#include <vector>
 
 namespace hc {
-    class Video: public View, public lrcpp::Video {
+    class Video: public View, public Scriptable, public lrcpp::Video {
     public:
         Video(Desktop* desktop);
         virtual ~Video() {}
 
-        void init();
+        // In headless mode frames are only copied out of the core when
+        // captureFrames was enabled via Lua
+        void init(bool const headless, Perf* const perf);
         double getCoreFps() const;
+
+        // Uploads the latest frame produced by the core to the texture, must
+        // be called from the thread that owns the OpenGL context
+        void present();
+
+        // In turbo mode frames are only copied when the last one was already
+        // presented, must be called from the emulation thread
+        void setTurbo(bool const turbo);
+
+        // Frames are not copied at all while discarding, used to hide the
+        // frames run only to be rolled back
+        void setDiscard(bool const discard);
+
         bool getMousePos(int* const x, int* const y) const;
 
+        // Total time spent copying frames out of the core, in nanoseconds
+        uint64_t copyTime() const { return _copyPerf.total; }
+
+        static Video* check(lua_State* const L, int const index);
+
         // hc::View
         virtual char const* getTitle() override;
+        virtual void onCoreLoaded() override;
         virtual void onDraw() override;
+        virtual bool drawsCoreState() const override { return false; }
         virtual void onGameUnloaded() override;
         virtual void onCoreUnloaded() override;
 
+        // hc::Scriptable
+        virtual int push(lua_State* const L) override;
+
         // lrcpp::Video
         virtual bool setRotation(unsigned rotation) override;
         virtual bool getOverscan(bool* overscan) override;
@@ -48,16 +77,41 @@ namespace hc {
         virtual retro_proc_address_t getProcAddress(char const* symbol) override;
 
     protected:
+        // A frame copied out of the core, rows are tightly packed
+        struct Frame {
+            std::vector<uint8_t> pixels;
+            unsigned width;
+            unsigned height;
+            size_t pitch;
+        };
+
         void setupTexture(unsigned const width, unsigned const height);
 
+        static int l_captureFrames(lua_State* const L);
+        static int l_getFrame(lua_State* const L);
+
         unsigned _rotation;
         retro_pixel_format _pixelFormat;
         double _coreFps;
 
+        // Frames are produced by the emulation thread and uploaded by the UI
+        Mailbox<Frame> _frames;
+        bool _turbo;
+        bool _discard;
+        bool _headless;
+        bool _captureFrames;
+
+        Perf* _perf;
+        retro_perf_counter _copyPerf;
+
+        // Geometry set by the core, the texture is resized in present
+        std::atomic<unsigned> _maxWidth;
+        std::atomic<unsigned> _maxHeight;
+        std::atomic<float> _aspectRatio;
+
         GLuint _texture;
         unsigned _textureWidth;
         unsigned _textureHeight;
-        float _aspectRatio;
         unsigned _width;
         unsigned _height;
 
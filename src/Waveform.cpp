@@ -0,0 +1,231 @@
+#include "Waveform.h"
+
+#ifdef _USE_SSE2
+#include <emmintrin.h>
+#endif
+
+static size_t nextPowerOfTwo(size_t const size) {
+    size_t power = 1;
+
+    while (power < size) {
+        power <<= 1;
+    }
+
+    return power;
+}
+
+// Computes the min and max of each channel in interleaved stereo samples
+static void minMax(int16_t const* const samples, size_t const frames, hc::Waveform::Column* const column) {
+    int16_t minL = INT16_MAX, minR = INT16_MAX;
+    int16_t maxL = INT16_MIN, maxR = INT16_MIN;
+    size_t i = 0;
+
+#ifdef _USE_SSE2
+    if (frames >= 4) {
+        // Left samples end up in the even lanes and right ones in the odd lanes
+        __m128i min = _mm_set1_epi16(INT16_MAX);
+        __m128i max = _mm_set1_epi16(INT16_MIN);
+
+        for (; i + 4 <= frames; i += 4) {
+            __m128i const s = _mm_loadu_si128(reinterpret_cast<__m128i const*>(samples + i * 2));
+            min = _mm_min_epi16(min, s);
+            max = _mm_max_epi16(max, s);
+        }
+
+        // Fold the four frames in each register down to one
+        min = _mm_min_epi16(min, _mm_shuffle_epi32(min, _MM_SHUFFLE(1, 0, 3, 2)));
+        min = _mm_min_epi16(min, _mm_shuffle_epi32(min, _MM_SHUFFLE(2, 3, 0, 1)));
+        max = _mm_max_epi16(max, _mm_shuffle_epi32(max, _MM_SHUFFLE(1, 0, 3, 2)));
+        max = _mm_max_epi16(max, _mm_shuffle_epi32(max, _MM_SHUFFLE(2, 3, 0, 1)));
+
+        minL = static_cast<int16_t>(_mm_extract_epi16(min, 0));
+        minR = static_cast<int16_t>(_mm_extract_epi16(min, 1));
+        maxL = static_cast<int16_t>(_mm_extract_epi16(max, 0));
+        maxR = static_cast<int16_t>(_mm_extract_epi16(max, 1));
+    }
+#endif
+
+    for (; i < frames; i++) {
+        int16_t const left = samples[i * 2];
+        int16_t const right = samples[i * 2 + 1];
+
+        minL = left < minL ? left : minL;
+        maxL = left > maxL ? left : maxL;
+        minR = right < minR ? right : minR;
+        maxR = right > maxR ? right : maxR;
+    }
+
+    column->min[0] = minL;
+    column->min[1] = minR;
+    column->max[0] = maxL;
+    column->max[1] = maxR;
+}
+
+hc::Waveform::Waveform() {
+    for (unsigned i = 0; i < Levels; i++) {
+        _levels[i].buckets = nullptr;
+        _levels[i].mask = 0;
+        _levels[i].count = 0;
+        reset(&_levels[i].pending);
+        _levels[i].pendingCount = 0;
+    }
+}
+
+hc::Waveform::~Waveform() {
+    destroy();
+}
+
+bool hc::Waveform::init(size_t const frames) {
+    destroy();
+
+    size_t bucketFrames = BucketFrames;
+
+    for (unsigned i = 0; i < Levels; i++) {
+        // Round up, and keep some slack for the buckets being read while the
+        // producer overwrites the oldest ones
+        size_t const size = nextPowerOfTwo((frames + bucketFrames - 1) / bucketFrames + 1) * 2;
+
+        _levels[i].buckets = new std::atomic<uint64_t>[size];
+        _levels[i].mask = size - 1;
+        bucketFrames *= LevelFactor;
+    }
+
+    clear();
+    return true;
+}
+
+void hc::Waveform::destroy() {
+    for (unsigned i = 0; i < Levels; i++) {
+        delete[] _levels[i].buckets;
+        _levels[i].buckets = nullptr;
+        _levels[i].mask = 0;
+    }
+}
+
+void hc::Waveform::clear() {
+    for (unsigned i = 0; i < Levels; i++) {
+        _levels[i].count.store(0, std::memory_order_release);
+        reset(&_levels[i].pending);
+        _levels[i].pendingCount = 0;
+    }
+}
+
+void hc::Waveform::add(int16_t const* samples, size_t frames) {
+    if (_levels[0].buckets == nullptr) {
+        return;
+    }
+
+    Level& level = _levels[0];
+
+    while (frames != 0) {
+        // The first level counts frames in pendingCount, not buckets
+        size_t const missing = BucketFrames - level.pendingCount;
+        size_t const count = frames < missing ? frames : missing;
+
+        Column column;
+        minMax(samples, count, &column);
+        merge(&level.pending, column);
+
+        level.pendingCount += count;
+        samples += count * 2;
+        frames -= count;
+
+        if (level.pendingCount == BucketFrames) {
+            push(0, level.pending);
+            reset(&level.pending);
+            level.pendingCount = 0;
+        }
+    }
+}
+
+size_t hc::Waveform::get(size_t const frames, Column* const columns, size_t const count) const {
+    if (_levels[0].buckets == nullptr || count == 0) {
+        return 0;
+    }
+
+    // Use the coarsest level that still has a bucket for each column
+    unsigned index = 0;
+    size_t bucketFrames = BucketFrames;
+
+    while (index < Levels - 1 && frames / (bucketFrames * LevelFactor) >= count) {
+        index++;
+        bucketFrames *= LevelFactor;
+    }
+
+    Level const& level = _levels[index];
+    uint64_t const total = level.count.load(std::memory_order_acquire);
+    uint64_t const wanted = (frames + bucketFrames - 1) / bucketFrames;
+    uint64_t const capacity = (level.mask + 1) / 2;
+
+    uint64_t available = total < wanted ? total : wanted;
+    available = available < capacity ? available : capacity;
+
+    if (available == 0) {
+        return 0;
+    }
+
+    size_t const filled = available < count ? static_cast<size_t>(available) : count;
+    uint64_t const first = total - available;
+
+    for (size_t i = 0; i < filled; i++) {
+        uint64_t const begin = first + available * i / filled;
+        uint64_t const end = first + available * (i + 1) / filled;
+
+        reset(&columns[i]);
+
+        for (uint64_t j = begin; j < end; j++) {
+            merge(&columns[i], unpack(level.buckets[j & level.mask].load(std::memory_order_relaxed)));
+        }
+    }
+
+    return filled;
+}
+
+void hc::Waveform::push(unsigned const index, Column const& column) {
+    Level& level = _levels[index];
+    uint64_t const count = level.count.load(std::memory_order_relaxed);
+
+    level.buckets[count & level.mask].store(pack(column), std::memory_order_relaxed);
+    level.count.store(count + 1, std::memory_order_release);
+
+    if (index == Levels - 1) {
+        return;
+    }
+
+    Level& next = _levels[index + 1];
+    merge(&next.pending, column);
+
+    if (++next.pendingCount == LevelFactor) {
+        push(index + 1, next.pending);
+        reset(&next.pending);
+        next.pendingCount = 0;
+    }
+}
+
+uint64_t hc::Waveform::pack(Column const& column) {
+    return static_cast<uint64_t>(static_cast<uint16_t>(column.min[0]))
+         | static_cast<uint64_t>(static_cast<uint16_t>(column.min[1])) << 16
+         | static_cast<uint64_t>(static_cast<uint16_t>(column.max[0])) << 32
+         | static_cast<uint64_t>(static_cast<uint16_t>(column.max[1])) << 48;
+}
+
+hc::Waveform::Column hc::Waveform::unpack(uint64_t const bucket) {
+    Column column;
+    column.min[0] = static_cast<int16_t>(bucket & 0xffff);
+    column.min[1] = static_cast<int16_t>((bucket >> 16) & 0xffff);
+    column.max[0] = static_cast<int16_t>((bucket >> 32) & 0xffff);
+    column.max[1] = static_cast<int16_t>((bucket >> 48) & 0xffff);
+    return column;
+}
+
+void hc::Waveform::merge(Column* const column, Column const& other) {
+    for (unsigned i = 0; i < 2; i++) {
+        column->min[i] = other.min[i] < column->min[i] ? other.min[i] : column->min[i];
+        column->max[i] = other.max[i] > column->max[i] ? other.max[i] : column->max[i];
+    }
+}
+
+void hc::Waveform::reset(Column* const column) {
+    column->min[0] = column->min[1] = INT16_MAX;
+    column->max[0] = column->max[1] = INT16_MIN;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+namespace hc {
+    // Keeps a history of stereo audio as a pyramid of min/max buckets, so that
+    // any window can be drawn at a cost proportional to its width in pixels.
+    // Only one thread may add samples, but any thread can read columns.
+    class Waveform final {
+    public:
+        enum {
+            // Frames summarized by each bucket in the first level
+            BucketFrames = 64,
+            // Each level has buckets LevelFactor times bigger than the previous
+            LevelFactor = 4,
+            Levels = 4
+        };
+
+        struct Column {
+            int16_t min[2];
+            int16_t max[2];
+        };
+
+        Waveform();
+        ~Waveform();
+
+        // The history holds at least the given number of frames
+        bool init(size_t const frames);
+        void destroy();
+
+        // Must only be called when no other thread is adding samples
+        void clear();
+
+        void add(int16_t const* const samples, size_t const frames);
+
+        // Fills up to count columns summarizing the last frames in the
+        // history, and returns the number of columns actually filled
+        size_t get(size_t const frames, Column* const columns, size_t const count) const;
+
+    protected:
+        struct Level {
+            std::atomic<uint64_t>* buckets;
+            size_t mask;
+            std::atomic<uint64_t> count;
+
+            // Accumulates buckets until there are enough to push one bucket
+            // to the next level
+            Column pending;
+            unsigned pendingCount;
+        };
+
+        void push(unsigned const level, Column const& column);
+
+        static uint64_t pack(Column const& column);
+        static Column unpack(uint64_t const bucket);
+        static void merge(Column* const column, Column const& other);
+        static void reset(Column* const column);
+
+        Level _levels[Levels];
+    };
+}
@@ -7,6 +7,8 @@ extern "C" {
     #include <lauxlib.h>
 }
 
+#include <vector>
+
 #include "Cheats.lua.h"
 
 static int s_onFrame = LUA_NOREF;
@@ -19,6 +21,30 @@ static int l_universal(lua_State* const L) {
     return hc::Set::universal()->push(L);
 }
 
+static void checkSets(lua_State* const L, int const index, std::vector<hc::Set const*>* const sets) {
+    luaL_checktype(L, index, LUA_TTABLE);
+    lua_Integer const count = luaL_len(L, index);
+    sets->reserve(count);
+
+    for (lua_Integer i = 1; i <= count; i++) {
+        lua_geti(L, index, i);
+        sets->emplace_back(hc::Set::check(L, -1));
+        lua_pop(L, 1);
+    }
+}
+
+static int l_unionAll(lua_State* const L) {
+    std::vector<hc::Set const*> sets;
+    checkSets(L, 1, &sets);
+    return hc::Set::unionAll(sets.data(), sets.size())->push(L);
+}
+
+static int l_intersectAll(lua_State* const L) {
+    std::vector<hc::Set const*> sets;
+    checkSets(L, 1, &sets);
+    return hc::Set::intersectAll(sets.data(), sets.size())->push(L);
+}
+
 static int l_filter(lua_State* const L) {
     char const* const op_str = luaL_checkstring(L, 2);
     char const* const settings = luaL_checkstring(L, 4);
@@ -94,6 +120,8 @@ int hc::cheats::push(lua_State* const L) {
         {"empty", l_empty},
         {"universal", l_universal},
         {"filter", l_filter},
+        {"unionAll", l_unionAll},
+        {"intersectAll", l_intersectAll},
         {nullptr, nullptr}
     };
 
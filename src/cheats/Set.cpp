@@ -5,11 +5,110 @@
 #include <atomic>
 #include <algorithm>
 #include <iterator>
+#include <thread>
 
 extern "C" {
     #include "lauxlib.h"
 }
 
+namespace {
+    // A position inside the elements of one of the sets being merged
+    struct Cursor {
+        uint64_t const* current;
+        uint64_t const* end;
+        bool complemented;
+    };
+
+    // Which elements survive the merge, given in how many plain and in how
+    // many complemented sets they were found
+    struct Rule {
+        size_t minPlain;
+        size_t maxPlain;
+        size_t minComplemented;
+        size_t maxComplemented;
+
+        bool keep(size_t const plain, size_t const complemented) const {
+            return plain >= minPlain && plain <= maxPlain &&
+                   complemented >= minComplemented && complemented <= maxComplemented;
+        }
+    };
+
+    // Merges smaller than this are not worth the cost of starting threads
+    size_t const ParallelThreshold = 1 << 18;
+    size_t const MaxPartitions = 8;
+}
+
+static bool greater(Cursor const& a, Cursor const& b) {
+    return *a.current > *b.current;
+}
+
+static void merge(std::vector<Cursor> heap, Rule const& rule, std::vector<uint64_t>* const result) {
+    heap.erase(
+        std::remove_if(heap.begin(), heap.end(), [](Cursor const& cursor) { return cursor.current == cursor.end; }),
+        heap.end()
+    );
+
+    std::make_heap(heap.begin(), heap.end(), greater);
+
+    while (!heap.empty()) {
+        uint64_t const element = *heap.front().current;
+        size_t plain = 0;
+        size_t complemented = 0;
+
+        // Sets have unique elements, so each cursor at the top holds element
+        // at most once
+        do {
+            std::pop_heap(heap.begin(), heap.end(), greater);
+            Cursor& cursor = heap.back();
+
+            if (cursor.complemented) {
+                complemented++;
+            }
+            else {
+                plain++;
+            }
+
+            if (++cursor.current == cursor.end) {
+                heap.pop_back();
+            }
+            else {
+                std::push_heap(heap.begin(), heap.end(), greater);
+            }
+        }
+        while (!heap.empty() && *heap.front().current == element);
+
+        if (rule.keep(plain, complemented)) {
+            result->emplace_back(element);
+        }
+    }
+}
+
+// Returns the smallest value that has at least rank elements below it when
+// considering all cursors together. Splitting on values instead of on
+// positions keeps equal elements from different sets in the same partition.
+static uint64_t split(std::vector<Cursor> const& cursors, size_t const rank) {
+    uint64_t low = 0;
+    uint64_t high = UINT64_MAX;
+
+    while (low < high) {
+        uint64_t const middle = low + (high - low) / 2;
+        size_t count = 0;
+
+        for (auto const& cursor : cursors) {
+            count += std::lower_bound(cursor.current, cursor.end, middle) - cursor.current;
+        }
+
+        if (count < rank) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
 hc::Set::Set() : _complemented(false) {}
 
 bool hc::Set::contains(uint64_t element) const {
@@ -245,6 +344,120 @@ hc::Set* hc::Set::complement() const {
     return result;
 }
 
+hc::Set* hc::Set::unionAll(Set const* const* sets, size_t count) {
+    return mergeAll(sets, count, true);
+}
+
+hc::Set* hc::Set::intersectAll(Set const* const* sets, size_t count) {
+    return mergeAll(sets, count, false);
+}
+
+hc::Set* hc::Set::mergeAll(Set const* const* sets, size_t count, bool isUnion) {
+    std::vector<Cursor> cursors;
+    cursors.reserve(count);
+
+    size_t plainCount = 0;
+    size_t complementedCount = 0;
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        Set const* const set = sets[i];
+        Cursor const cursor = {set->_elements.data(), set->_elements.data() + set->_elements.size(), set->_complemented};
+        cursors.emplace_back(cursor);
+
+        if (set->_complemented) {
+            complementedCount++;
+        }
+        else {
+            plainCount++;
+        }
+
+        total += set->_elements.size();
+    }
+
+    Set* result = new Set;
+    Rule rule;
+
+    if (isUnion) {
+        if (complementedCount == 0) {
+            // A + B + ...
+            rule = {1, plainCount, 0, 0};
+        }
+        else {
+            // A + ... + ~B + ~C + ... = ~((B * C * ...) - (A + ...))
+            rule = {0, 0, complementedCount, complementedCount};
+            result->_complemented = true;
+        }
+    }
+    else {
+        if (plainCount != 0) {
+            // A * B * ... * ~C * ~D * ... = (A * B * ...) - (C + D + ...)
+            rule = {plainCount, plainCount, 0, 0};
+        }
+        else {
+            // ~A * ~B * ... = ~(A + B + ...)
+            rule = {0, 0, 1, complementedCount};
+            result->_complemented = true;
+        }
+    }
+
+    size_t partitions = std::min<size_t>(std::thread::hardware_concurrency(), MaxPartitions);
+
+    if (total < ParallelThreshold || partitions < 2) {
+        result->_elements.reserve(isUnion ? total : total / std::max<size_t>(count, 1));
+        merge(cursors, rule, &result->_elements);
+        result->_elements.shrink_to_fit();
+        return result;
+    }
+
+    // Partition the address space so that each partition has about the same
+    // number of elements, and merge the partitions in parallel
+    std::vector<std::vector<Cursor>> ranges(partitions);
+    std::vector<std::vector<uint64_t>> merged(partitions);
+    uint64_t low = 0;
+
+    for (size_t p = 0; p < partitions; p++) {
+        bool const last = p == partitions - 1;
+        uint64_t const high = last ? UINT64_MAX : split(cursors, total * (p + 1) / partitions);
+
+        for (auto const& cursor : cursors) {
+            Cursor range = cursor;
+            range.current = std::lower_bound(cursor.current, cursor.end, low);
+            range.end = last ? cursor.end : std::lower_bound(range.current, cursor.end, high);
+            ranges[p].emplace_back(range);
+        }
+
+        low = high;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(partitions - 1);
+
+    for (size_t p = 1; p < partitions; p++) {
+        threads.emplace_back(merge, ranges[p], rule, &merged[p]);
+    }
+
+    merge(ranges[0], rule, &merged[0]);
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    size_t size = 0;
+
+    for (auto const& part : merged) {
+        size += part.size();
+    }
+
+    result->_elements.reserve(size);
+
+    for (auto const& part : merged) {
+        result->_elements.insert(result->_elements.end(), part.begin(), part.end());
+    }
+
+    return result;
+}
+
 hc::Set* hc::Set::empty() {
     Set* result = new Set;
     result->_complemented = false;
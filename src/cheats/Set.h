@@ -25,6 +25,11 @@ namespace hc {
         Set* difference(Set const* other) const;
         Set* complement() const;
 
+        // k-way versions of union_ and intersection, merging all sets in a
+        // single pass instead of allocating one intermediate set per pair
+        static Set* unionAll(Set const* const* sets, size_t count);
+        static Set* intersectAll(Set const* const* sets, size_t count);
+
         static Set* empty();
         static Set* universal();
 
@@ -39,6 +44,8 @@ namespace hc {
     protected:
         Set();
 
+        static Set* mergeAll(Set const* const* sets, size_t count, bool isUnion);
+
         static int l_size(lua_State* const L);
         static int l_contains(lua_State* const L);
         static int l_union(lua_State* const L);
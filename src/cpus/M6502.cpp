@@ -68,6 +68,10 @@ void hc::M6502::onDraw() {
     }
 }
 
+bool hc::M6502::wantsTurboFrames() const {
+    return false;
+}
+
 uint64_t hc::M6502::disasm(uint64_t address, hc::Memory const* memory, char* buffer, size_t size) {
     struct Userdata {
         hc::Memory const* memory;
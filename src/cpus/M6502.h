@@ -17,6 +17,7 @@ namespace hc {
         // hc::View
         virtual void onFrame() override;
         virtual void onDraw() override;
+        virtual bool wantsTurboFrames() const override;
 
     protected:
         static uint64_t disasm(uint64_t address, Memory const* memory, char* buffer, size_t size);
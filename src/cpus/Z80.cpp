@@ -72,6 +72,10 @@ void hc::Z80::onDraw() {
     }
 }
 
+bool hc::Z80::wantsTurboFrames() const {
+    return false;
+}
+
 uint64_t hc::Z80::disasm(uint64_t address, Memory const* memory, char* buffer, size_t size) {
     struct Userdata {
         Memory const* memory;
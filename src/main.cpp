@@ -1,16 +1,81 @@
 #include "Application.h"
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 
-int main(int, char**) {
+static int usage(char const* const program) {
+    fprintf(stderr, "Usage: %s [--headless [--core <path>] [--content <path>] <script.lua> [args...]]\n", program);
+    fprintf(stderr, "       %s --bench <frames> --core <path> --content <path> [--state <path>]\n", program);
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char** argv) {
+    bool headless = false;
+    char const* corePath = nullptr;
+    char const* contentPath = nullptr;
+    char const* statePath = nullptr;
+    unsigned benchFrames = 0;
+    int arg = 1;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "--headless") == 0) {
+            headless = true;
+        }
+        else if (strcmp(argv[arg], "--core") == 0 && arg + 1 < argc) {
+            corePath = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--content") == 0 && arg + 1 < argc) {
+            contentPath = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--state") == 0 && arg + 1 < argc) {
+            statePath = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--bench") == 0 && arg + 1 < argc) {
+            benchFrames = static_cast<unsigned>(strtoul(argv[++arg], nullptr, 10));
+
+            if (benchFrames == 0) {
+                return usage(argv[0]);
+            }
+        }
+        else {
+            return usage(argv[0]);
+        }
+    }
+
+    if (benchFrames != 0) {
+        // Benchmarks always run headless, and need a game
+        if (headless || arg < argc || corePath == nullptr || contentPath == nullptr) {
+            return usage(argv[0]);
+        }
+    }
+    else if (statePath != nullptr) {
+        return usage(argv[0]);
+    }
+    else if (headless != (arg < argc) || (!headless && (corePath != nullptr || contentPath != nullptr))) {
+        // The script and its arguments are only used in headless mode
+        return usage(argv[0]);
+    }
+
     hc::Application app;
 
-    if (!app.init("Hackable Console", 1024, 640)) {
+    if (!app.init("Hackable Console", 1024, 640, headless || benchFrames != 0)) {
         return EXIT_FAILURE;
     }
 
-    app.run();
+    int status = EXIT_SUCCESS;
+
+    if (benchFrames != 0) {
+        status = app.runBenchmark(corePath, contentPath, statePath, benchFrames);
+    }
+    else if (headless) {
+        status = app.runHeadless(corePath, contentPath, argv[arg], argc - arg - 1, argv + arg + 1);
+    }
+    else {
+        app.run();
+    }
+
     app.destroy();
-    return EXIT_SUCCESS;
+    return status;
 }